@@ -1,9 +1,13 @@
 #pragma once
+#include <numeric>
+
 #include "../utils.hh"
 #include "dataflow_analysis.hh"
 
 namespace whilelang {
-    enum class CPAbstractType { Bottom, Constant, Top };
+    // The codes are chosen such that the join of two types is their bitwise
+    // or, unless two different constants meet
+    enum class CPAbstractType : uint8_t { Bottom = 0, Constant = 1, Top = 3 };
 
     struct CPLatticeValue {
         CPAbstractType type;
@@ -70,17 +74,71 @@ namespace whilelang {
         }
     };
 
-    using CPState = std::map<std::string, CPLatticeValue>;
+    // Packed constant propagation state, the abstract type and the constant
+    // of every variable are stored in two parallel arrays
+    class CPState {
+      public:
+        CPState() = default;
+
+        CPState(size_t size, CPLatticeValue value)
+        : types(size, value.type), values(size, value.value.value_or(0)) {}
+
+        size_t size() const {
+            return types.size();
+        }
+
+        CPLatticeValue get(size_t i) const {
+            if (types[i] == CPAbstractType::Constant) {
+                return CPLatticeValue::constant(values[i]);
+            }
+            return {types[i], std::nullopt};
+        }
+
+        void set(size_t i, const CPLatticeValue &value) {
+            types[i] = value.type;
+            values[i] = value.type == CPAbstractType::Constant ? *value.value : 0;
+        }
+
+        // Branch free join of every variable, constants that disagree
+        // become top. Non constant entries always carry the value 0
+        bool join(const CPState &other) {
+            bool changed = false;
+
+            for (size_t i = 0; i < types.size(); i++) {
+                auto x = static_cast<uint8_t>(types[i]);
+                auto y = static_cast<uint8_t>(other.types[i]);
+                int vx = values[i];
+                int vy = other.values[i];
+
+                uint8_t conflict = (x & y & 1) && vx != vy ? 0b10 : 0;
+                uint8_t type = x | y | conflict;
+                int value = type == 1 ? (x == 0 ? vy : vx) : 0;
+
+                changed |= type != x || value != vx;
+                types[i] = static_cast<CPAbstractType>(type);
+                values[i] = value;
+            }
+            return changed;
+        }
+
+        bool operator==(const CPState &other) const = default;
 
-    CPLatticeValue get_lattice_value_from_atom(Node inst, CPState incoming_state) {
+      private:
+        std::vector<CPAbstractType> types;
+        std::vector<int> values;
+    };
+
+    inline CPLatticeValue get_lattice_value_from_atom(
+        Node inst,
+        const CPState &incoming_state,
+        const std::shared_ptr<ControlFlow> &cfg) {
         if (inst == Atom || inst == BAtom) {
             Node expr = inst / Expr;
 
             if (expr == Int) {
                 return CPLatticeValue::constant(get_int_value(expr));
             } else if (expr == Ident) {
-                std::string rhs_ident = get_identifier(expr);
-                return incoming_state[rhs_ident];
+                return incoming_state.get(cfg->get_var_id(expr));
             } else if (expr == True || expr == False) {
                 return CPLatticeValue::constant(expr == True ? 1 : 0);
             }
@@ -89,7 +147,7 @@ namespace whilelang {
         return CPLatticeValue::top();
     }
 
-    int apply_op(Node op, int x, int y) {
+    inline int apply_op(Node op, int x, int y) {
         if (op == Add) {
             return x + y;
         } else if (op == Sub) {
@@ -111,106 +169,149 @@ namespace whilelang {
         }
     };
 
-    CPState cp_first_state(std::shared_ptr<ControlFlow> cfg) {
-        auto first_state = CPState();
+    inline CPState cp_first_state(std::shared_ptr<ControlFlow> cfg) {
+        return CPState(cfg->get_vars().size(), CPLatticeValue::top());
+    }
 
-        for (auto var : cfg->get_vars()) {
-            first_state[var] = CPLatticeValue::top();
+    // Return values of functions memoized per calling context, where a
+    // context is the abstract value of every parameter. A function keeps at
+    // most context_limit contexts, calls beyond that share one context in
+    // which every parameter is top.
+    class CPSummaries {
+      public:
+        static constexpr size_t context_limit = 4;
+
+        CPLatticeValue
+        get(const Node &fun_def,
+            std::vector<CPLatticeValue> context,
+            const std::shared_ptr<ControlFlow> &cfg);
+
+        void clear() {
+            summaries.clear();
         }
-        return first_state;
-    }
 
-    struct CPImpl {
-		using StateTable = NodeMap<CPState>;
+      private:
+        struct Summary {
+            std::vector<CPLatticeValue> context;
+            // Empty while the summary is being computed
+            std::optional<CPLatticeValue> result;
+        };
+
+        std::unordered_map<const NodeDef *, std::vector<Summary>> summaries;
+
+        // Solves the body of the function on its own, starting from the
+        // context, and joins the values of its return statements
+        CPLatticeValue solve(
+            const Node &fun_def,
+            const std::vector<CPLatticeValue> &context,
+            const std::shared_ptr<ControlFlow> &cfg);
+    };
 
-        static CPState create_state(const Vars &vars) {
-            CPState state = CPState();
+    // State table of constant propagation, which also holds the function
+    // summaries of the current solve. The summaries are built for one
+    // program and dropped whenever the table is set up again.
+    class CPStateTable : public InstructionStates<CPState> {
+      public:
+        CPSummaries summaries;
 
-            for (auto var : vars) {
-                state[var] = CPLatticeValue::bottom();
-            }
-            return state;
+        void reset(std::shared_ptr<ControlFlow> cfg, const CPState &bottom) {
+            summaries.clear();
+            InstructionStates<CPState>::reset(cfg, bottom);
         }
 
-        static bool state_join(CPState &x, const CPState &y) {
-            bool changed = false;
-
-            auto it1 = x.begin();
-            auto it2 = y.begin();
+        bool retain(std::shared_ptr<ControlFlow> cfg) {
+            summaries.clear();
+            return InstructionStates<CPState>::retain(cfg);
+        }
+    };
 
-            while (it1 != x.end() && it2 != y.end()) {
-                auto join_res = it1->second.join(it2->second);
+    struct CPImpl {
+		using StateTable = CPStateTable;
 
-                if (join_res != it1->second) {
-                    it1->second = join_res;
-                    changed = true;
-                }
-                it1++;
-                it2++;
-            }
+        static CPState create_state(const Vars &vars) {
+            return CPState(vars.size(), CPLatticeValue::bottom());
+        }
 
-            if (it1 != x.end() || it2 != y.end()) {
+        static bool state_join(CPState &x, const CPState &y) {
+            if (x.size() != y.size()) {
                 throw std::runtime_error("States are not comparable");
             }
 
-            return changed;
+            return x.join(y);
         }
 
         static CPState flow(
             const Node &inst,
             StateTable &state_table,
             std::shared_ptr<ControlFlow> cfg) {
-            auto incoming_state = state_table[inst];
+            auto state_of = [&](const Node &n) -> const CPState & {
+                return state_table[n];
+            };
+            return transfer(inst, state_of, state_table.summaries, cfg);
+        }
+
+        // The flow of an instruction, where state_of gives the state before
+        // any instruction of the same function
+        template<typename StateOf>
+        static CPState transfer(
+            const Node &inst,
+            StateOf state_of,
+            CPSummaries &summaries,
+            const std::shared_ptr<ControlFlow> &cfg) {
+            CPState incoming_state = state_of(inst);
 
             if (inst == Assign) {
-                std::string var = get_identifier(inst / Ident);
+                VarId var = cfg->get_var_id(inst / Ident);
 
                 auto expr = (inst / Rhs) / Expr;
                 if (expr == Atom || expr == BAtom) {
-                    incoming_state[var] =
-                        get_lattice_value_from_atom(expr, incoming_state);
+                    incoming_state.set(
+                        var,
+                        get_lattice_value_from_atom(expr, incoming_state, cfg));
                 } else if (expr == Not) {
                     Node atom = expr / BAtom;
                     auto atom_value =
-                        get_lattice_value_from_atom(atom, incoming_state);
+                        get_lattice_value_from_atom(atom, incoming_state, cfg);
 
                     if (atom_value.type == CPAbstractType::Constant) {
                         auto op_result = *atom_value.value == 1? 0: 1;
-                        incoming_state[var] =
-                            CPLatticeValue::constant(op_result);
+                        incoming_state.set(
+                            var, CPLatticeValue::constant(op_result));
                     } else {
-                        incoming_state[var] = CPLatticeValue::top();
+                        incoming_state.set(var, CPLatticeValue::top());
                     }
                 } else if (expr->type().in({Add, Sub, Mul, And, Or, LT, Equals})) {
                     Node lhs = expr / Lhs;
                     Node rhs = expr / Rhs;
 
-                    auto lhs_value = get_lattice_value_from_atom(lhs, incoming_state);
-                    auto rhs_value = get_lattice_value_from_atom(rhs, incoming_state);
+                    auto lhs_value =
+                        get_lattice_value_from_atom(lhs, incoming_state, cfg);
+                    auto rhs_value =
+                        get_lattice_value_from_atom(rhs, incoming_state, cfg);
 
                     if (lhs_value.type == CPAbstractType::Constant &&
                         rhs_value.type == CPAbstractType::Constant) {
                         auto op_result = apply_op(
                             expr, *lhs_value.value, *rhs_value.value);
-                        incoming_state[var] =
-                            CPLatticeValue::constant(op_result);
+                        incoming_state.set(
+                            var, CPLatticeValue::constant(op_result));
                     } else {
-                        incoming_state[var] = CPLatticeValue::top();
+                        incoming_state.set(var, CPLatticeValue::top());
                     }
                 } else {
-                    // Is function call
-                    auto prevs = cfg->predecessors(inst);
-                    CPLatticeValue val = CPLatticeValue::bottom();
-
-                    // Join result of all return statements
-                    for (auto prev : prevs) {
-                        if (prev == Return) {
-                            val = val.join(get_lattice_value_from_atom(
-                                prev / Atom, state_table[prev]));
-                        }
+                    // Is function call, the returned value only depends on
+                    // the arguments and is taken from the summaries
+                    auto pre_fun_call_state = state_of(expr);
+                    std::vector<CPLatticeValue> context;
+
+                    for (auto arg : *(expr / ArgList)) {
+                        context.push_back(get_lattice_value_from_atom(
+                            arg / Atom, pre_fun_call_state, cfg));
                     }
-                    auto pre_fun_call_state = state_table[expr];
-                    pre_fun_call_state[var] = val;
+
+                    auto val = summaries.get(
+                        cfg->get_fun_def(expr), std::move(context), cfg);
+                    pre_fun_call_state.set(var, val);
                     return pre_fun_call_state;
                 }
             } else if (inst == FunCall) {
@@ -219,36 +320,120 @@ namespace whilelang {
 
                 for (size_t i = 0; i < params->size(); i++) {
                     auto param_id = params->at(i) / Ident;
-
-                    auto var_dec = get_identifier(param_id);
                     auto arg = args->at(i) / Atom;
 
-                    incoming_state[var_dec] =
-                        get_lattice_value_from_atom(arg, incoming_state);
+                    incoming_state.set(
+                        cfg->get_var_id(param_id),
+                        get_lattice_value_from_atom(arg, incoming_state, cfg));
                 }
             } else if (
                 inst == FunDef &&
-                get_identifier(inst / FunId) != "main") {
-                auto params = inst / ParamList;
-
-                auto param_vars = Vars();
-                for (auto param : *params) {
-                    param_vars.insert(get_identifier(param / Ident));
-                }
+                (inst / FunId)->location().view() != "main") {
+                // Only the parameters are known when entering a function
+                auto fun_state = create_state(cfg->get_vars());
 
-                for (auto &[key, val] : incoming_state) {
-                    if (!param_vars.contains(key)) {
-                        incoming_state[key] = CPLatticeValue::bottom();
-                    }
+                for (auto param : *(inst / ParamList)) {
+                    VarId var = cfg->get_var_id(param / Ident);
+                    fun_state.set(var, incoming_state.get(var));
                 }
+                return fun_state;
             }
             return incoming_state;
         }
     };
 
-    std::ostream &operator<<(std::ostream &os, const CPState &state) {
-        for (const auto &[_, value] : state) {
-            os << std::setw(PRINT_WIDTH) << value;
+    inline CPLatticeValue CPSummaries::get(
+        const Node &fun_def,
+        std::vector<CPLatticeValue> context,
+        const std::shared_ptr<ControlFlow> &cfg) {
+        auto find = [&]() -> Summary * {
+            for (auto &summary : summaries[fun_def.get()]) {
+                if (summary.context == context) {
+                    return &summary;
+                }
+            }
+            return nullptr;
+        };
+
+        Summary *summary = find();
+
+        if (!summary && summaries[fun_def.get()].size() >= context_limit) {
+            context.assign(context.size(), CPLatticeValue::top());
+            summary = find();
+        }
+
+        if (summary) {
+            // A summary without a result is a recursive call
+            return summary->result.value_or(CPLatticeValue::top());
+        }
+
+        summaries[fun_def.get()].push_back({context, std::nullopt});
+        CPLatticeValue result = solve(fun_def, context, cfg);
+
+        // Recursive calls may have added summaries in the meantime
+        find()->result = result;
+        return result;
+    }
+
+    inline CPLatticeValue CPSummaries::solve(
+        const Node &fun_def,
+        const std::vector<CPLatticeValue> &context,
+        const std::shared_ptr<ControlFlow> &cfg) {
+        const auto &function_of = cfg->get_function_partition();
+        const uint32_t begin = cfg->get_index(fun_def);
+        uint32_t end = begin + 1;
+
+        while (end < function_of.size() &&
+               function_of[end] == function_of[begin]) {
+            end++;
+        }
+
+        std::vector<CPState> states(
+            end - begin, CPImpl::create_state(cfg->get_vars()));
+        auto params = fun_def / ParamList;
+
+        for (size_t i = 0; i < params->size(); i++) {
+            states[0].set(cfg->get_var_id(params->at(i) / Ident), context[i]);
+        }
+
+        auto state_of = [&](const Node &n) -> const CPState & {
+            return states[cfg->get_index(n) - begin];
+        };
+
+        std::vector<uint32_t> order(end - begin);
+        std::iota(order.begin(), order.end(), 0);
+        PriorityWorklist worklist(order);
+        worklist.push(0);
+
+        while (!worklist.empty()) {
+            uint32_t i = worklist.pop();
+            const Node &inst = cfg->get_instruction(begin + i);
+            CPState out_state = CPImpl::transfer(inst, state_of, *this, cfg);
+
+            // Calls continue with the assignment of their result, also when
+            // the call opens a block and nothing before it bypasses the call
+            for (uint32_t succ : cfg->intraprocedural_successors(begin + i)) {
+                if (states[succ - begin].join(out_state)) {
+                    worklist.push(succ - begin);
+                }
+            }
+        }
+
+        CPLatticeValue result = CPLatticeValue::bottom();
+        for (uint32_t i = 0; i < states.size(); i++) {
+            const Node &inst = cfg->get_instruction(begin + i);
+
+            if (inst == Return) {
+                result = result.join(
+                    get_lattice_value_from_atom(inst / Atom, states[i], cfg));
+            }
+        }
+        return result;
+    }
+
+    inline std::ostream &operator<<(std::ostream &os, const CPState &state) {
+        for (size_t i = 0; i < state.size(); i++) {
+            os << std::setw(PRINT_WIDTH) << state.get(i);
         }
         return os;
     }
@@ -1,12 +1,81 @@
 #pragma once
+#include <atomic>
+#include <exception>
+#include <queue>
+#include <thread>
+
 #include "../control_flow.hh"
 #include "../internal.hh"
+#include "dense_state.hh"
 
 #define PRINT_WIDTH 15
 
 namespace whilelang {
     using namespace trieste;
 
+    // Maps every instruction of a frozen ControlFlow to a state. The states
+    // are stored contiguously in instruction index order, nodes are
+    // translated to their index through the ControlFlow.
+    template<typename State>
+    class InstructionStates {
+      public:
+        void reset(std::shared_ptr<ControlFlow> cfg, const State &bottom) {
+            this->cfg = cfg;
+            instructions = cfg->get_instructions();
+            states.assign(instructions.size(), bottom);
+        }
+
+        // Moves the states over to the current instructions of cfg, which
+        // must be the instructions the table was built for with some of
+        // them removed. Returns false if they do not line up
+        bool retain(std::shared_ptr<ControlFlow> cfg) {
+            const Nodes &current = cfg->get_instructions();
+            std::vector<State> retained;
+            retained.reserve(current.size());
+
+            for (size_t i = 0; i < instructions.size(); i++) {
+                if (retained.size() < current.size() &&
+                    instructions[i] == current[retained.size()]) {
+                    retained.push_back(std::move(states[i]));
+                }
+            }
+
+            if (retained.size() != current.size()) {
+                return false;
+            }
+
+            this->cfg = cfg;
+            instructions = current;
+            states = std::move(retained);
+            return true;
+        }
+
+        size_t size() const {
+            return states.size();
+        }
+
+        State &operator[](const Node &inst) {
+            return states[cfg->get_index(inst)];
+        }
+
+        const State &at(const Node &inst) const {
+            return states.at(cfg->get_index(inst));
+        }
+
+        State &at(size_t index) {
+            return states[index];
+        }
+
+        const State &at(size_t index) const {
+            return states[index];
+        }
+
+      private:
+        std::shared_ptr<ControlFlow> cfg;
+        Nodes instructions;
+        std::vector<State> states;
+    };
+
     template<typename Impl, typename State>
     concept DataflowImplementation = requires(
         Impl impl,
@@ -14,11 +83,11 @@ namespace whilelang {
         State s2,
         const Vars &vars,
         const Node &node,
-        NodeMap<State> &stateTable,
+        typename Impl::StateTable &stateTable,
         std::shared_ptr<ControlFlow> cfg) {
-        typename Impl::StateTable;
-
-        requires std::same_as<typename Impl::StateTable, NodeMap<State>>;
+        // Implementations may extend the state table with data of their own
+        requires std::
+            derived_from<typename Impl::StateTable, InstructionStates<State>>;
 
         // Creates a state which has not yet been reached.
         // Typically maps all variables to bottom
@@ -33,6 +102,110 @@ namespace whilelang {
         { Impl::flow(node, stateTable, cfg) } -> std::same_as<State>;
     };
 
+    // Implementations over lattices of infinite height also widen, which
+    // the forward solver does instead of joining at loop headers and at
+    // the targets of calls and returns. Every cycle of the interprocedural
+    // graph passes one of them, so the solver terminates
+    template<typename Impl, typename State>
+    concept WideningImplementation = requires(State s1, State s2) {
+        // Widens the first state by the second, storing the result in the
+        // first one. Returns a bool stating if the first state changed
+        { Impl::state_widen(s1, s2) } -> std::same_as<bool>;
+    };
+
+    // Implementations that widen may also narrow. Starting from the widened
+    // fixpoint the forward solver then iterates downwards, narrowing at the
+    // widening points, which recovers bounds that widening gave up on
+    template<typename Impl, typename State>
+    concept NarrowingImplementation = WideningImplementation<Impl, State> &&
+        requires(State s1, State s2) {
+            // Narrows the first state by the second, which lies below it,
+            // storing the result in the first one. Returns a bool stating
+            // if the first state changed
+            { Impl::state_narrow(s1, s2) } -> std::same_as<bool>;
+            { s1 == s2 } -> std::same_as<bool>;
+        };
+
+    // Implementations may know more on some edges than the flow of the
+    // instruction they leave, e.g. that the condition of a branch holds on
+    // the edge into its then branch
+    template<typename Impl, typename State>
+    concept RefiningImplementation = requires(
+        const State &state,
+        const Node &node,
+        std::shared_ptr<ControlFlow> cfg) {
+        // The state on the edge from the first instruction to the second,
+        // given the flow of the first. Empty when the edge adds nothing
+        {
+            Impl::refine(node, node, state, cfg)
+        } -> std::same_as<std::optional<State>>;
+    };
+
+    // Worklist handing out the pending instruction index that comes first
+    // in the given order. Pushing an instruction which is already queued is
+    // a no-op, so every instruction is queued at most once at a time.
+    // The worklist may be split into partitions, each with its own heap, so
+    // that different threads can work on different partitions.
+    class PriorityWorklist {
+      public:
+        explicit PriorityWorklist(const std::vector<uint32_t> &order)
+        : PriorityWorklist(order, {}, 1) {}
+
+        PriorityWorklist(
+            const std::vector<uint32_t> &order,
+            std::vector<uint32_t> partition_of,
+            size_t partitions)
+        : order(order),
+          priority(order.size()),
+          queued(order.size(), 0),
+          partition_of(std::move(partition_of)),
+          heaps(partitions) {
+            for (size_t i = 0; i < order.size(); i++) {
+                priority[order[i]] = i;
+            }
+        }
+
+        bool empty(size_t partition = 0) const {
+            return heaps[partition].empty();
+        }
+
+        void push(uint32_t inst) {
+            uint32_t p = priority[inst];
+
+            if (!queued[p]) {
+                queued[p] = 1;
+                heaps[partition(inst)].push(p);
+            }
+        }
+
+        uint32_t pop(size_t partition = 0) {
+            Heap &heap = heaps[partition];
+            uint32_t p = heap.top();
+            heap.pop();
+            queued[p] = 0;
+
+            return order[p];
+        }
+
+      private:
+        using Heap = std::priority_queue<
+            uint32_t,
+            std::vector<uint32_t>,
+            std::greater<uint32_t>>;
+
+        std::vector<uint32_t> order;
+        std::vector<uint32_t> priority;
+        // One byte per instruction, so threads working on different
+        // partitions never write to the same memory location
+        std::vector<uint8_t> queued;
+        std::vector<uint32_t> partition_of;
+        std::vector<Heap> heaps;
+
+        size_t partition(uint32_t inst) const {
+            return partition_of.empty() ? 0 : partition_of[inst];
+        }
+    };
+
     // The State represents the mapping of code information (typically
     // variables) to the abstract values (LatticeValue)
     // The Impl struct must follow the DataflowImplementation concept
@@ -41,14 +214,32 @@ namespace whilelang {
     class DataFlowAnalysis {
       public:
         // Tracks a mapping from all program points to their corresponding state
-        using StateTable = NodeMap<State>;
+        using StateTable = typename Impl::StateTable;
 
         DataFlowAnalysis();
 
-        State get_state(const Node &instruction) {
+        // With warm starts enabled the solvers keep the previous fixpoint
+        // and only solve again what is reachable from the changes recorded
+        // in the ControlFlow since then
+        explicit DataFlowAnalysis(bool warm_start);
+
+        // For forward analyses this is the state before the instruction,
+        // for backward analyses the state after it
+        const State &get_state(const Node &instruction) const {
             return state_table.at(instruction);
         };
 
+        // Number of flow function evaluations the last solve needed
+        size_t get_flow_evaluations() const {
+            return flow_evaluations;
+        };
+
+        // With more than one thread the functions of the program are solved
+        // in parallel, see solve_parallel
+        void set_threads(size_t threads) {
+            this->threads = std::max<size_t>(threads, 1);
+        };
+
         void forward_worklist_algoritm(
             std::shared_ptr<ControlFlow> cfg, State first_state);
 
@@ -60,12 +251,76 @@ namespace whilelang {
 
       private:
         StateTable state_table;
+        size_t flow_evaluations = 0;
+
+        // Instructions joined by widening, only set for forward solves of
+        // a WideningImplementation
+        std::vector<uint8_t> widening_points;
+
+        size_t threads = 1;
+        bool warm_start = false;
+        bool solved = false;
+        size_t solved_generation = 0;
+        size_t seen_changes = 0;
 
         void init_state_table(
-            const Nodes &instructions,
-            const Vars &vars,
-            const Node &program_entry,
+            std::shared_ptr<ControlFlow> cfg,
+            const Node &program_start,
             State &first_state);
+
+        // Resets the states of every instruction reachable from a recorded
+        // change, following successors when forward is set and predecessors
+        // otherwise. Returns which instructions were reset, or nothing if
+        // the previous fixpoint can not be reused
+        std::optional<std::vector<bool>> invalidate_changed(
+            std::shared_ptr<ControlFlow> cfg,
+            const Node &program_start,
+            State &first_state,
+            bool forward);
+
+        void mark_solved(std::shared_ptr<ControlFlow> cfg);
+
+        void find_widening_points(std::shared_ptr<ControlFlow> cfg);
+
+        PriorityWorklist make_worklist(
+            std::shared_ptr<ControlFlow> cfg,
+            const std::vector<uint32_t> &order);
+
+        // Evaluates the flow of an instruction and joins the result into
+        // its successors, or its predecessors when solving backwards
+        void evaluate(
+            std::shared_ptr<ControlFlow> cfg,
+            PriorityWorklist &worklist,
+            uint32_t inst,
+            bool forward,
+            size_t &evaluations);
+
+        void solve(
+            std::shared_ptr<ControlFlow> cfg,
+            PriorityWorklist &worklist,
+            bool forward);
+
+        void solve_parallel(
+            std::shared_ptr<ControlFlow> cfg,
+            PriorityWorklist &worklist,
+            bool forward);
+
+        // Joins the result of the flow of inst into target, the state of
+        // other, widening it when widen is set. Forward edges are refined
+        // first when the implementation supports it
+        bool join_edge(
+            std::shared_ptr<ControlFlow> cfg,
+            State &target,
+            uint32_t inst,
+            uint32_t other,
+            const State &result,
+            bool forward,
+            bool widen);
+
+        void narrow(
+            std::shared_ptr<ControlFlow> cfg,
+            const Node &program_start,
+            const State &first_state);
     };
 
     template<typename State, typename LatticeValue, typename Impl>
@@ -74,50 +329,452 @@ namespace whilelang {
         this->state_table = StateTable();
     }
 
+    template<typename State, typename LatticeValue, typename Impl>
+        requires DataflowImplementation<Impl, State>
+    DataFlowAnalysis<State, LatticeValue, Impl>::DataFlowAnalysis(
+        bool warm_start)
+    : warm_start(warm_start) {
+        this->state_table = StateTable();
+    }
+
+    template<typename State, typename LatticeValue, typename Impl>
+        requires DataflowImplementation<Impl, State>
+    std::optional<std::vector<bool>>
+    DataFlowAnalysis<State, LatticeValue, Impl>::invalidate_changed(
+        std::shared_ptr<ControlFlow> cfg,
+        const Node &program_start,
+        State &first_state,
+        bool forward) {
+        if (!warm_start || !solved ||
+            solved_generation != cfg->get_generation() ||
+            !state_table.retain(cfg)) {
+            return std::nullopt;
+        }
+
+        const Nodes &changes = cfg->get_change_log();
+        const size_t n = cfg->get_instructions().size();
+        std::vector<bool> reset(n, false);
+        std::vector<uint32_t> stack;
+
+        for (size_t i = seen_changes; i < changes.size(); i++) {
+            if (cfg->is_instruction(changes[i])) {
+                uint32_t inst = cfg->get_index(changes[i]);
+
+                if (!reset[inst]) {
+                    reset[inst] = true;
+                    stack.push_back(inst);
+                }
+            }
+        }
+
+        while (!stack.empty()) {
+            uint32_t inst = stack.back();
+            stack.pop_back();
+
+            auto next = forward ? cfg->successor_indices(inst)
+                                : cfg->predecessor_indices(inst);
+            for (uint32_t other : next) {
+                if (!reset[other]) {
+                    reset[other] = true;
+                    stack.push_back(other);
+                }
+            }
+        }
+
+        const State bottom = Impl::create_state(cfg->get_vars());
+        size_t reset_count = 0;
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (reset[i]) {
+                state_table.at(i) = bottom;
+                reset_count++;
+            }
+        }
+
+        if (cfg->is_instruction(program_start) &&
+            reset[cfg->get_index(program_start)]) {
+            state_table[program_start] = first_state;
+        }
+
+        logging::Debug() << "Warm start resets " << reset_count << " of " << n
+                         << " instructions";
+        return reset;
+    }
+
+    template<typename State, typename LatticeValue, typename Impl>
+        requires DataflowImplementation<Impl, State>
+    void DataFlowAnalysis<State, LatticeValue, Impl>::mark_solved(
+        std::shared_ptr<ControlFlow> cfg) {
+        solved = true;
+        solved_generation = cfg->get_generation();
+        seen_changes = cfg->get_change_log().size();
+    }
+
+    template<typename State, typename LatticeValue, typename Impl>
+        requires DataflowImplementation<Impl, State>
+    void DataFlowAnalysis<State, LatticeValue, Impl>::find_widening_points(
+        std::shared_ptr<ControlFlow> cfg) {
+        const size_t n = cfg->get_instructions().size();
+        widening_points.assign(n, 0);
+
+        for (const Loop &loop : cfg->get_loop_forest().loops) {
+            widening_points[loop.header] = 1;
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            const Node &inst = cfg->get_instruction(i);
+
+            if (inst == FunCall || inst == Return) {
+                for (uint32_t succ : cfg->successor_indices(i)) {
+                    widening_points[succ] = 1;
+                }
+            }
+        }
+    }
+
+    template<typename State, typename LatticeValue, typename Impl>
+        requires DataflowImplementation<Impl, State>
+    PriorityWorklist DataFlowAnalysis<State, LatticeValue, Impl>::make_worklist(
+        std::shared_ptr<ControlFlow> cfg, const std::vector<uint32_t> &order) {
+        if (threads > 1 && cfg->get_function_count() > 1) {
+            return PriorityWorklist(
+                order,
+                cfg->get_function_partition(),
+                cfg->get_function_count());
+        }
+        return PriorityWorklist(order);
+    }
+
+    template<typename State, typename LatticeValue, typename Impl>
+        requires DataflowImplementation<Impl, State>
+    void DataFlowAnalysis<State, LatticeValue, Impl>::evaluate(
+        std::shared_ptr<ControlFlow> cfg,
+        PriorityWorklist &worklist,
+        uint32_t inst,
+        bool forward,
+        size_t &evaluations) {
+        State result = Impl::flow(cfg->get_instruction(inst), state_table, cfg);
+        evaluations++;
+
+        auto next = forward ? cfg->successor_indices(inst)
+                            : cfg->predecessor_indices(inst);
+        for (uint32_t other : next) {
+            bool widen = false;
+
+            if constexpr (WideningImplementation<Impl, State>) {
+                widen = forward && widening_points[other];
+            }
+
+            if (join_edge(
+                    cfg,
+                    state_table.at(other),
+                    inst,
+                    other,
+                    result,
+                    forward,
+                    widen)) {
+                worklist.push(other);
+            }
+        }
+    }
+
+    template<typename State, typename LatticeValue, typename Impl>
+        requires DataflowImplementation<Impl, State>
+    bool DataFlowAnalysis<State, LatticeValue, Impl>::join_edge(
+        std::shared_ptr<ControlFlow> cfg,
+        State &target,
+        uint32_t inst,
+        uint32_t other,
+        const State &result,
+        bool forward,
+        bool widen) {
+        const State *edge = &result;
+        std::optional<State> refined;
+
+        if constexpr (RefiningImplementation<Impl, State>) {
+            if (forward) {
+                refined = Impl::refine(
+                    cfg->get_instruction(inst),
+                    cfg->get_instruction(other),
+                    result,
+                    cfg);
+                if (refined) {
+                    edge = &*refined;
+                }
+            }
+        }
+
+        if constexpr (WideningImplementation<Impl, State>) {
+            if (widen) {
+                return Impl::state_widen(target, *edge);
+            }
+        }
+        return Impl::state_join(target, *edge);
+    }
+
+    template<typename State, typename LatticeValue, typename Impl>
+        requires DataflowImplementation<Impl, State>
+    void DataFlowAnalysis<State, LatticeValue, Impl>::solve(
+        std::shared_ptr<ControlFlow> cfg,
+        PriorityWorklist &worklist,
+        bool forward) {
+        if (threads > 1 && cfg->get_function_count() > 1) {
+            solve_parallel(cfg, worklist, forward);
+            return;
+        }
+
+        while (!worklist.empty()) {
+            evaluate(cfg, worklist, worklist.pop(), forward, flow_evaluations);
+        }
+    }
+
+    // Solves every function on its own thread. An instruction with an edge
+    // to another function is a boundary instruction: its flow may read the
+    // states of the other function or data shared between functions, and
+    // its result is joined into them. Threads therefore
+    // only evaluate the interior of their function and defer the boundary
+    // instructions, which are evaluated sequentially once all threads are
+    // done. This repeats until no function has pending work, which is the
+    // same fixpoint the sequential solver reaches.
+    template<typename State, typename LatticeValue, typename Impl>
+        requires DataflowImplementation<Impl, State>
+    void DataFlowAnalysis<State, LatticeValue, Impl>::solve_parallel(
+        std::shared_ptr<ControlFlow> cfg,
+        PriorityWorklist &worklist,
+        bool forward) {
+        const size_t n = cfg->get_instructions().size();
+        const size_t functions = cfg->get_function_count();
+        const auto &function_of = cfg->get_function_partition();
+
+        // Calls and returns are boundary instructions even when a function
+        // calls itself, as the flow of a call may consult data shared by
+        // all functions
+        std::vector<uint8_t> boundary(n, 0);
+        for (uint32_t i = 0; i < n; i++) {
+            const Node &inst = cfg->get_instruction(i);
+            bool interprocedural = inst == FunCall || inst == Return;
+
+            for (uint32_t succ : cfg->successor_indices(i)) {
+                if (interprocedural || function_of[succ] != function_of[i]) {
+                    boundary[i] = 1;
+                    boundary[succ] = 1;
+                }
+            }
+        }
+
+        std::vector<std::vector<uint32_t>> deferred(functions);
+        std::vector<size_t> evaluations(functions, 0);
+        std::vector<size_t> pending;
+        size_t rounds = 0;
+
+        while (true) {
+            pending.clear();
+            for (size_t f = 0; f < functions; f++) {
+                if (!worklist.empty(f)) {
+                    pending.push_back(f);
+                }
+            }
+
+            if (pending.empty()) {
+                break;
+            }
+            rounds++;
+
+            const size_t workers = std::min(threads, pending.size());
+            std::atomic<size_t> next_task = 0;
+            std::vector<std::exception_ptr> errors(workers);
+
+            auto work = [&](size_t worker) {
+                try {
+                    for (size_t task = next_task++; task < pending.size();
+                         task = next_task++) {
+                        size_t f = pending[task];
+
+                        while (!worklist.empty(f)) {
+                            uint32_t inst = worklist.pop(f);
+
+                            if (boundary[inst]) {
+                                deferred[f].push_back(inst);
+                            } else {
+                                evaluate(
+                                    cfg, worklist, inst, forward,
+                                    evaluations[f]);
+                            }
+                        }
+                    }
+                } catch (...) {
+                    errors[worker] = std::current_exception();
+                }
+            };
+
+            std::vector<std::thread> pool;
+            for (size_t worker = 1; worker < workers; worker++) {
+                pool.emplace_back(work, worker);
+            }
+            work(0);
+
+            for (auto &thread : pool) {
+                thread.join();
+            }
+            for (auto &error : errors) {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+            }
+
+            for (size_t f : pending) {
+                auto &insts = deferred[f];
+                std::sort(insts.begin(), insts.end());
+                insts.erase(std::unique(insts.begin(), insts.end()), insts.end());
+
+                for (uint32_t inst : insts) {
+                    evaluate(cfg, worklist, inst, forward, evaluations[f]);
+                }
+                insts.clear();
+            }
+        }
+
+        for (size_t count : evaluations) {
+            flow_evaluations += count;
+        }
+        logging::Debug() << "Solved " << functions << " functions on "
+                         << threads << " threads in " << rounds << " rounds";
+    }
+
     template<typename State, typename LatticeValue, typename Impl>
         requires DataflowImplementation<Impl, State>
     void DataFlowAnalysis<State, LatticeValue, Impl>::init_state_table(
-        const Nodes &instructions,
-        const Vars &vars,
+        std::shared_ptr<ControlFlow> cfg,
         const Node &program_start,
         State &first_state) {
-        if (instructions.empty()) {
+        if (cfg->get_instructions().empty()) {
             throw std::runtime_error("No instructions exist for this program");
         }
-
-        for (const auto &inst : instructions) {
-            state_table.insert({inst, Impl::create_state(vars)});
+        if (!cfg->is_frozen()) {
+            throw std::runtime_error("Control flow graph is not frozen");
         }
 
-        state_table[program_start] = first_state;
+        // Copying one bottom state is cheaper than building a new one for
+        // every instruction
+        state_table.reset(cfg, Impl::create_state(cfg->get_vars()));
+
+        // The last statement of main is not necessarily an instruction,
+        // e.g. when it is an if statement
+        if (cfg->is_instruction(program_start)) {
+            state_table[program_start] = first_state;
+        }
     }
 
     template<typename State, typename LatticeValue, typename Impl>
         requires DataflowImplementation<Impl, State>
     void DataFlowAnalysis<State, LatticeValue, Impl>::forward_worklist_algoritm(
         std::shared_ptr<ControlFlow> cfg, State first_state) {
-        const auto instructions = cfg->get_instructions();
-        const Vars vars = cfg->get_vars();
+        const Node entry = cfg->get_program_entry();
 
-        std::deque<Node> worklist{cfg->get_program_entry()};
-        this->init_state_table(
-            instructions, vars, cfg->get_program_entry(), first_state);
+        // Visiting in reverse postorder evaluates every instruction after
+        // its forward predecessors, so only loop back edges cause revisits
+        PriorityWorklist worklist =
+            make_worklist(cfg, cfg->reverse_postorder());
+        flow_evaluations = 0;
 
-        while (!worklist.empty()) {
-            Node inst = worklist.front();
-            worklist.pop_front();
+        if constexpr (WideningImplementation<Impl, State>) {
+            find_widening_points(cfg);
+        }
+
+        auto reset = invalidate_changed(cfg, entry, first_state, true);
+
+        if (reset) {
+            // Resume from the instructions flowing into the reset region
+            for (uint32_t i = 0; i < reset->size(); i++) {
+                if (!(*reset)[i]) {
+                    continue;
+                }
+
+                for (uint32_t pred : cfg->predecessor_indices(i)) {
+                    if (!(*reset)[pred]) {
+                        worklist.push(pred);
+                    }
+                }
+            }
+
+            if ((*reset)[cfg->get_index(entry)]) {
+                worklist.push(cfg->get_index(entry));
+            }
+        } else {
+            this->init_state_table(cfg, entry, first_state);
+            worklist.push(cfg->get_index(entry));
+        }
 
-            State out_state = Impl::flow(inst, state_table, cfg);
-            state_table[inst] = out_state;
+        solve(cfg, worklist, true);
 
-            for (Node succ : cfg->successors(inst)) {
-                bool changed = Impl::state_join(state_table.at(succ), out_state);
+        if constexpr (NarrowingImplementation<Impl, State>) {
+            narrow(cfg, entry, first_state);
+        }
+
+        logging::Debug() << "Forward analysis converged after "
+                         << flow_evaluations << " flow evaluations";
+        mark_solved(cfg);
+    }
 
-                if (changed) {
-                    worklist.push_back(succ);
+    // Every round evaluates each instruction against the states of the
+    // previous round and joins the results along the edges. The new states
+    // replace the old ones, except at the widening points where they only
+    // narrow them. Starting from a fixpoint of the widened solve every
+    // round stays above the least fixpoint, and the narrowing terminates
+    // the descent as every cycle passes a widening point
+    template<typename State, typename LatticeValue, typename Impl>
+        requires DataflowImplementation<Impl, State>
+    void DataFlowAnalysis<State, LatticeValue, Impl>::narrow(
+        std::shared_ptr<ControlFlow> cfg,
+        const Node &program_start,
+        const State &first_state) {
+        const size_t n = cfg->get_instructions().size();
+        const State bottom = Impl::create_state(cfg->get_vars());
+        const std::optional<uint32_t> start =
+            cfg->is_instruction(program_start)
+            ? std::optional(cfg->get_index(program_start))
+            : std::nullopt;
+
+        size_t rounds = 0;
+        bool changed = true;
+
+        while (changed) {
+            std::vector<State> next(n, bottom);
+            if (start) {
+                next[*start] = first_state;
+            }
+
+            for (uint32_t i = 0; i < n; i++) {
+                // Instructions the solve never reached are not evaluated,
+                // as their flow could make up states for their successors
+                if (i != start && state_table.at(i) == bottom) {
+                    continue;
+                }
+
+                State result =
+                    Impl::flow(cfg->get_instruction(i), state_table, cfg);
+                flow_evaluations++;
+
+                for (uint32_t succ : cfg->successor_indices(i)) {
+                    join_edge(cfg, next[succ], i, succ, result, true, false);
+                }
+            }
+
+            changed = false;
+            for (uint32_t i = 0; i < n; i++) {
+                State &state = state_table.at(i);
+
+                if (widening_points[i]) {
+                    changed |= Impl::state_narrow(state, next[i]);
+                } else if (!(state == next[i])) {
+                    state = std::move(next[i]);
+                    changed = true;
                 }
             }
+            rounds++;
         }
+
+        logging::Debug() << "Narrowing took " << rounds << " rounds";
     }
 
     template<typename State, typename LatticeValue, typename Impl>
@@ -125,28 +782,45 @@ namespace whilelang {
     void
     DataFlowAnalysis<State, LatticeValue, Impl>::backward_worklist_algoritm(
         std::shared_ptr<ControlFlow> cfg, State first_state) {
-        const auto instructions = cfg->get_instructions();
-        const Vars vars = cfg->get_vars();
+        const Node exit = cfg->get_program_exit();
 
-        std::deque<Node> worklist{instructions.begin(), instructions.end()};
-        this->init_state_table(
-            instructions, vars, cfg->get_program_exit(), first_state);
+        // Postorder evaluates every instruction after its successors, so
+        // only loop back edges cause revisits
+        std::vector<uint32_t> order = cfg->reverse_postorder();
+        std::reverse(order.begin(), order.end());
 
-        while (!worklist.empty()) {
-            Node inst = worklist.front();
-            worklist.pop_front();
+        PriorityWorklist worklist = make_worklist(cfg, order);
+        flow_evaluations = 0;
 
-            State in_state = Impl::flow(inst, state_table, cfg);
+        auto reset = invalidate_changed(cfg, exit, first_state, false);
 
-            for (Node pred : cfg->predecessors(inst)) {
-                State &succ_state = state_table[pred];
-                bool changed = Impl::state_join(succ_state, in_state);
+        if (reset) {
+            // Every reset instruction is evaluated again, together with the
+            // instructions flowing into the reset region
+            for (uint32_t i = 0; i < reset->size(); i++) {
+                if (!(*reset)[i]) {
+                    continue;
+                }
 
-                if (changed) {
-                    worklist.push_back(pred);
+                worklist.push(i);
+                for (uint32_t succ : cfg->successor_indices(i)) {
+                    if (!(*reset)[succ]) {
+                        worklist.push(succ);
+                    }
                 }
             }
+        } else {
+            this->init_state_table(cfg, exit, first_state);
+
+            for (uint32_t inst : order) {
+                worklist.push(inst);
+            }
         }
+
+        solve(cfg, worklist, false);
+        logging::Debug() << "Backward analysis converged after "
+                         << flow_evaluations << " flow evaluations";
+        mark_solved(cfg);
     }
 
     // Requires the user to define the << operator for the State type
@@ -154,13 +828,14 @@ namespace whilelang {
         requires DataflowImplementation<Impl, State>
     void DataFlowAnalysis<State, LatticeValue, Impl>::log_state_table(
         std::shared_ptr<ControlFlow> cfg) {
-        auto instructions = cfg->get_instructions();
-        const int number_of_vars = cfg->get_vars().size();
+        const auto &instructions = cfg->get_instructions();
+        const Vars &vars = cfg->get_vars();
+        const int number_of_vars = vars.size();
         std::stringstream str_builder;
 
         str_builder << std::left << std::setw(PRINT_WIDTH) << "";
-        for (auto var : cfg->get_vars()) {
-            str_builder << std::setw(PRINT_WIDTH) << var;
+        for (VarId var = 0; var < vars.size(); var++) {
+            str_builder << std::setw(PRINT_WIDTH) << vars.name(var);
         }
 
         str_builder << std::endl;
@@ -169,7 +844,7 @@ namespace whilelang {
 
         for (size_t i = 0; i < instructions.size(); i++) {
             str_builder << std::setw(PRINT_WIDTH) << i + 1
-                        << state_table[instructions[i]] << '\n';
+                        << state_table.at(i) << '\n';
         }
         logging::Debug() << str_builder.str();
     }
@@ -0,0 +1,144 @@
+#pragma once
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace whilelang {
+    // A dense state stores exactly one entry per variable of the program,
+    // addressed by the index the ControlFlow assigned to that variable.
+    // Joining two dense states is a single loop over flat arrays, which the
+    // compiler is able to vectorize.
+    template<typename State>
+    concept DenseState = requires(State s, const State &other) {
+        { s.size() } -> std::same_as<size_t>;
+
+        // Joins other into s, returning whether s changed
+        { s.join(other) } -> std::same_as<bool>;
+
+        { s == other } -> std::same_as<bool>;
+    };
+
+    // Set of variable indices stored as one bit per variable
+    class BitVector {
+      public:
+        using Word = uint64_t;
+        static constexpr size_t word_bits = 64;
+
+        BitVector() : bits(0) {}
+
+        explicit BitVector(size_t size)
+        : bits(size), words((size + word_bits - 1) / word_bits, 0) {}
+
+        size_t size() const {
+            return bits;
+        }
+
+        bool contains(size_t i) const {
+            return (words[i / word_bits] >> (i % word_bits)) & 1;
+        }
+
+        void insert(size_t i) {
+            words[i / word_bits] |= Word(1) << (i % word_bits);
+        }
+
+        void erase(size_t i) {
+            words[i / word_bits] &= ~(Word(1) << (i % word_bits));
+        }
+
+        bool join(const BitVector &other) {
+            Word changed = 0;
+
+            for (size_t i = 0; i < words.size(); i++) {
+                Word joined = words[i] | other.words[i];
+                changed |= joined ^ words[i];
+                words[i] = joined;
+            }
+            return changed != 0;
+        }
+
+        bool operator==(const BitVector &other) const = default;
+
+        // Calls f with the index of every variable in the set, in order
+        template<typename F>
+        void for_each(F f) const {
+            for (size_t i = 0; i < words.size(); i++) {
+                Word word = words[i];
+
+                while (word) {
+                    f(i * word_bits + std::countr_zero(word));
+                    word &= word - 1;
+                }
+            }
+        }
+
+      private:
+        size_t bits;
+        std::vector<Word> words;
+    };
+
+    // Array of 2-bit lattice codes, 32 variables per word. Only suitable for
+    // lattices whose join is the bitwise or of the codes, such as
+    // Bottom = 00, A = 01, B = 10, Top = 11.
+    class CodeVector {
+      public:
+        using Word = uint64_t;
+        static constexpr size_t codes_per_word = 32;
+
+        CodeVector() : codes(0) {}
+
+        CodeVector(size_t size, uint8_t code)
+        : codes(size),
+          words((size + codes_per_word - 1) / codes_per_word, fill(code)) {
+            // Keep the unused codes of the last word zero so that equal
+            // states always compare equal
+            if (size % codes_per_word != 0) {
+                words.back() &= (Word(1) << shift(size)) - 1;
+            }
+        }
+
+        size_t size() const {
+            return codes;
+        }
+
+        uint8_t get(size_t i) const {
+            return (words[i / codes_per_word] >> shift(i)) & 0b11;
+        }
+
+        void set(size_t i, uint8_t code) {
+            Word &word = words[i / codes_per_word];
+            word = (word & ~(Word(0b11) << shift(i))) |
+                (Word(code & 0b11) << shift(i));
+        }
+
+        bool join(const CodeVector &other) {
+            Word changed = 0;
+
+            for (size_t i = 0; i < words.size(); i++) {
+                Word joined = words[i] | other.words[i];
+                changed |= joined ^ words[i];
+                words[i] = joined;
+            }
+            return changed != 0;
+        }
+
+        bool operator==(const CodeVector &other) const = default;
+
+      private:
+        size_t codes;
+        std::vector<Word> words;
+
+        static size_t shift(size_t i) {
+            return (i % codes_per_word) * 2;
+        }
+
+        static Word fill(uint8_t code) {
+            Word word = 0;
+            for (size_t i = 0; i < codes_per_word; i++) {
+                word |= Word(code & 0b11) << (i * 2);
+            }
+            return word;
+        }
+    };
+}
@@ -0,0 +1,449 @@
+#pragma once
+#include <limits>
+
+#include "../utils.hh"
+#include "dataflow_analysis.hh"
+
+namespace whilelang {
+    // Range of values a variable may hold. The bounds are kept in 64 bits so
+    // that arithmetic on int32 bounds can not overflow, booleans are the
+    // ranges within [0, 1]
+    struct Interval {
+        static constexpr int64_t min = std::numeric_limits<int32_t>::min();
+        static constexpr int64_t max = std::numeric_limits<int32_t>::max();
+
+        // Empty when lo > hi
+        int64_t lo;
+        int64_t hi;
+
+        bool operator==(const Interval &other) const {
+            return (is_bottom() && other.is_bottom()) ||
+                (lo == other.lo && hi == other.hi);
+        }
+
+        bool is_bottom() const {
+            return lo > hi;
+        }
+
+        bool is_constant() const {
+            return lo == hi;
+        }
+
+        // Whether every value lies outside of the int32 range
+        bool overflows() const {
+            return !is_bottom() && (lo > max || hi < min);
+        }
+
+        Interval join(const Interval &other) const {
+            if (is_bottom()) {
+                return other;
+            } else if (other.is_bottom()) {
+                return *this;
+            }
+            return {std::min(lo, other.lo), std::max(hi, other.hi)};
+        }
+
+        Interval meet(const Interval &other) const {
+            Interval res = {std::max(lo, other.lo), std::min(hi, other.hi)};
+            return res.is_bottom() ? bottom() : res;
+        }
+
+        // Bounds that are still moving jump to the end of the int32 range,
+        // so ascending chains are at most two steps long
+        Interval widen(const Interval &other) const {
+            if (is_bottom()) {
+                return other;
+            } else if (other.is_bottom()) {
+                return *this;
+            }
+            return {other.lo < lo ? min : lo, other.hi > hi ? max : hi};
+        }
+
+        // Only the bounds at the end of the int32 range, where widening
+        // may have put them, are taken from the smaller other interval, so
+        // descending chains are at most two steps long as well
+        Interval narrow(const Interval &other) const {
+            if (is_bottom() || other.is_bottom()) {
+                return other;
+            }
+            return {lo == min ? other.lo : lo, hi == max ? other.hi : hi};
+        }
+
+        friend std::ostream &
+        operator<<(std::ostream &os, const Interval &value) {
+            // Formatted as a whole, so the field width applies to all of it
+            if (value.is_bottom()) {
+                os << "_";
+            } else if (value.lo == min && value.hi == max) {
+                os << "?";
+            } else {
+                os << "[" + std::to_string(value.lo) + "," +
+                        std::to_string(value.hi) + "]";
+            }
+            return os;
+        }
+
+        static Interval top() {
+            return {min, max};
+        }
+        static Interval bottom() {
+            return {1, 0};
+        }
+        static Interval constant(int64_t v) {
+            return {v, v};
+        }
+        static Interval boolean() {
+            return {0, 1};
+        }
+    };
+
+    class IntervalState {
+      public:
+        IntervalState() = default;
+
+        IntervalState(size_t size, Interval value) : values(size, value) {}
+
+        size_t size() const {
+            return values.size();
+        }
+
+        Interval get(size_t i) const {
+            return values[i];
+        }
+
+        void set(size_t i, Interval value) {
+            values[i] = value;
+        }
+
+        bool join(const IntervalState &other) {
+            bool changed = false;
+
+            for (size_t i = 0; i < values.size(); i++) {
+                Interval joined = values[i].join(other.values[i]);
+                changed |= !(joined == values[i]);
+                values[i] = joined;
+            }
+            return changed;
+        }
+
+        bool widen(const IntervalState &other) {
+            bool changed = false;
+
+            for (size_t i = 0; i < values.size(); i++) {
+                Interval widened =
+                    values[i].widen(values[i].join(other.values[i]));
+                changed |= !(widened == values[i]);
+                values[i] = widened;
+            }
+            return changed;
+        }
+
+        bool narrow(const IntervalState &other) {
+            bool changed = false;
+
+            for (size_t i = 0; i < values.size(); i++) {
+                Interval narrowed = values[i].narrow(other.values[i]);
+                changed |= !(narrowed == values[i]);
+                values[i] = narrowed;
+            }
+            return changed;
+        }
+
+        bool operator==(const IntervalState &other) const = default;
+
+      private:
+        std::vector<Interval> values;
+    };
+
+    inline Interval get_interval_from_atom(
+        const Node &atom,
+        const IntervalState &incoming_state,
+        const std::shared_ptr<ControlFlow> &cfg) {
+        Node expr = atom / Expr;
+
+        if (expr == Int) {
+            return Interval::constant(get_int_value(expr));
+        } else if (expr == Ident) {
+            return incoming_state.get(cfg->get_var_id(expr));
+        } else if (expr == True || expr == False) {
+            return Interval::constant(expr == True ? 1 : 0);
+        }
+        return Interval::top();
+    }
+
+    // Exact range of an Add, Sub or Mul, which may lie outside of the int32
+    // range when the operation can overflow
+    inline Interval
+    apply_interval_op(const Node &op, const Interval &x, const Interval &y) {
+        if (x.is_bottom() || y.is_bottom()) {
+            return Interval::bottom();
+        } else if (op == Add) {
+            return {x.lo + y.lo, x.hi + y.hi};
+        } else if (op == Sub) {
+            return {x.lo - y.hi, x.hi - y.lo};
+        }
+
+        int64_t products[] = {
+            x.lo * y.lo, x.lo * y.hi, x.hi * y.lo, x.hi * y.hi};
+        return {
+            *std::min_element(std::begin(products), std::end(products)),
+            *std::max_element(std::begin(products), std::end(products))};
+    }
+
+    // Range of an LT, Equals, And or Or, as a boolean range
+    inline Interval
+    apply_interval_test(const Node &op, const Interval &x, const Interval &y) {
+        if (x.is_bottom() || y.is_bottom()) {
+            return Interval::bottom();
+        } else if (op == LT) {
+            if (x.hi < y.lo) {
+                return Interval::constant(1);
+            } else if (x.lo >= y.hi) {
+                return Interval::constant(0);
+            }
+        } else if (op == Equals) {
+            if (x.is_constant() && y.is_constant() && x.lo == y.lo) {
+                return Interval::constant(1);
+            } else if (x.hi < y.lo || y.hi < x.lo) {
+                return Interval::constant(0);
+            }
+        } else if (op == And) {
+            return {std::min(x.lo, y.lo), std::min(x.hi, y.hi)};
+        } else if (op == Or) {
+            return {std::max(x.lo, y.lo), std::max(x.hi, y.hi)};
+        }
+        return Interval::boolean();
+    }
+
+    // Ranges of the operands of x < y or x = y given that the comparison
+    // has the outcome, either may be empty when it can not
+    inline std::pair<Interval, Interval> refine_interval_test(
+        const Node &op, bool outcome, const Interval &x, const Interval &y) {
+        if (op == LT && outcome) {
+            return {
+                x.meet({Interval::min, y.hi - 1}),
+                y.meet({x.lo + 1, Interval::max})};
+        } else if (op == LT) {
+            return {
+                x.meet({y.lo, Interval::max}), y.meet({Interval::min, x.hi})};
+        } else if (outcome) {
+            return {x.meet(y), y.meet(x)};
+        }
+
+        // A constant is only excluded from the ends of the other range
+        auto exclude = [](Interval range, const Interval &value) {
+            if (value.is_constant() && range.lo == value.lo) {
+                range.lo++;
+            }
+            if (value.is_constant() && range.hi == value.lo) {
+                range.hi--;
+            }
+            return range.is_bottom() ? Interval::bottom() : range;
+        };
+        return {exclude(x, y), exclude(y, x)};
+    }
+
+    struct IntervalImpl {
+        using StateTable = InstructionStates<IntervalState>;
+
+        static IntervalState create_state(const Vars &vars) {
+            return IntervalState(vars.size(), Interval::bottom());
+        }
+
+        static bool state_join(IntervalState &x, const IntervalState &y) {
+            if (x.size() != y.size()) {
+                throw std::runtime_error("States are not comparable");
+            }
+
+            return x.join(y);
+        }
+
+        static bool state_widen(IntervalState &x, const IntervalState &y) {
+            if (x.size() != y.size()) {
+                throw std::runtime_error("States are not comparable");
+            }
+
+            return x.widen(y);
+        }
+
+        static bool state_narrow(IntervalState &x, const IntervalState &y) {
+            if (x.size() != y.size()) {
+                throw std::runtime_error("States are not comparable");
+            }
+
+            return x.narrow(y);
+        }
+
+        // The condition of a while or if holds on the edge into the loop
+        // body or then branch and fails on the other edges. When the
+        // condition was assigned a comparison right before the branch, the
+        // ranges of the compared variables are narrowed to the outcome as
+        // well. An edge the condition can not take is unreachable
+        static std::optional<IntervalState> refine(
+            const Node &inst,
+            const Node &succ,
+            const IntervalState &state,
+            std::shared_ptr<ControlFlow> cfg) {
+            if (inst != BAtom) {
+                return std::nullopt;
+            }
+
+            Node branch = inst->parent();
+            Node taken = branch == While ? branch / Do : branch / Then;
+            bool outcome = succ == get_first_basic_child(taken);
+            auto unreachable = create_state(cfg->get_vars());
+
+            Interval cond = get_interval_from_atom(inst, state, cfg)
+                                .meet(Interval::constant(outcome));
+            if (cond.is_bottom()) {
+                return unreachable;
+            } else if (inst / Expr != Ident) {
+                return std::nullopt;
+            }
+
+            IntervalState refined = state;
+            VarId var = cfg->get_var_id(inst / Expr);
+            refined.set(var, cond);
+
+            // The comparison must be the only way to reach the branch, so
+            // that its operands still hold the compared values
+            auto preds =
+                cfg->intraprocedural_predecessors(cfg->get_index(inst));
+            if (preds.size() != 1) {
+                return refined;
+            }
+
+            const Node &def = cfg->get_instruction(preds[0]);
+            if (def != Assign || cfg->get_var_id(def / Ident) != var) {
+                return refined;
+            }
+
+            Node expr = (def / Rhs) / Expr;
+            if (!expr->type().in({LT, Equals})) {
+                return refined;
+            }
+
+            // An operand that is the condition itself was overwritten by
+            // the comparison, its compared value is unknown
+            auto overwritten = [&](const Node &atom) {
+                return atom / Expr == Ident &&
+                    cfg->get_var_id(atom / Expr) == var;
+            };
+            auto compared = [&](const Node &atom) {
+                return overwritten(atom)
+                    ? Interval::top()
+                    : get_interval_from_atom(atom, state, cfg);
+            };
+
+            auto [x, y] = refine_interval_test(
+                expr, outcome, compared(expr / Lhs), compared(expr / Rhs));
+            if (x.is_bottom() || y.is_bottom()) {
+                return unreachable;
+            }
+
+            auto narrow_operand = [&](const Node &atom, const Interval &range) {
+                if (atom / Expr != Ident || overwritten(atom)) {
+                    return true;
+                }
+
+                VarId id = cfg->get_var_id(atom / Expr);
+                Interval narrowed = refined.get(id).meet(range);
+                refined.set(id, narrowed);
+                return !narrowed.is_bottom();
+            };
+
+            if (!narrow_operand(expr / Lhs, x) ||
+                !narrow_operand(expr / Rhs, y)) {
+                return unreachable;
+            }
+            return refined;
+        }
+
+        static IntervalState flow(
+            const Node &inst,
+            StateTable &state_table,
+            std::shared_ptr<ControlFlow> cfg) {
+            auto incoming_state = state_table[inst];
+
+            if (inst == Assign) {
+                VarId var = cfg->get_var_id(inst / Ident);
+                Node expr = (inst / Rhs) / Expr;
+
+                if (expr == Atom || expr == BAtom) {
+                    incoming_state.set(
+                        var, get_interval_from_atom(expr, incoming_state, cfg));
+                } else if (expr == Not) {
+                    auto x = get_interval_from_atom(
+                        expr / BAtom, incoming_state, cfg);
+                    incoming_state.set(
+                        var,
+                        x.is_bottom() ? x : Interval{1 - x.hi, 1 - x.lo});
+                } else if (expr->type().in({Add, Sub, Mul})) {
+                    auto range = apply_interval_op(
+                        expr,
+                        get_interval_from_atom(expr / Lhs, incoming_state, cfg),
+                        get_interval_from_atom(
+                            expr / Rhs, incoming_state, cfg));
+
+                    // The result wraps around when the operation may
+                    // overflow
+                    if (range.lo < Interval::min || range.hi > Interval::max) {
+                        range = Interval::top();
+                    }
+                    incoming_state.set(var, range);
+                } else if (expr->type().in({And, Or, LT, Equals})) {
+                    incoming_state.set(
+                        var,
+                        apply_interval_test(
+                            expr,
+                            get_interval_from_atom(
+                                expr / Lhs, incoming_state, cfg),
+                            get_interval_from_atom(
+                                expr / Rhs, incoming_state, cfg)));
+                } else {
+                    // Is function call, the result joins the values
+                    // returned by the callee, each read in the state at its
+                    // return. The variables of the caller are taken from
+                    // before the call
+                    Interval val = Interval::bottom();
+
+                    for (uint32_t prev :
+                         cfg->predecessor_indices(cfg->get_index(inst))) {
+                        const Node &node = cfg->get_instruction(prev);
+
+                        if (node == Return) {
+                            val = val.join(get_interval_from_atom(
+                                node / Atom, state_table[node], cfg));
+                        }
+                    }
+
+                    auto pre_fun_call_state = state_table[expr];
+                    pre_fun_call_state.set(var, val);
+                    return pre_fun_call_state;
+                }
+            } else if (inst == FunCall) {
+                auto params = cfg->get_fun_def(inst) / ParamList;
+                auto args = inst / ArgList;
+
+                for (size_t i = 0; i < params->size(); i++) {
+                    auto param_id = params->at(i) / Ident;
+                    auto arg = args->at(i) / Atom;
+
+                    incoming_state.set(
+                        cfg->get_var_id(param_id),
+                        get_interval_from_atom(arg, incoming_state, cfg));
+                }
+            }
+
+            return incoming_state;
+        }
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, const IntervalState &state) {
+        for (size_t i = 0; i < state.size(); i++) {
+            os << std::setw(PRINT_WIDTH) << state.get(i);
+        }
+        return os;
+    }
+}
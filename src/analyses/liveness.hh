@@ -3,42 +3,40 @@
 #include "dataflow_analysis.hh"
 
 namespace whilelang {
-    using LiveState = Vars;
+    // Set of live variables, one bit per variable index
+    using LiveState = BitVector;
 
-    Vars get_atom_defs(const Node &atom) {
+    inline void add_atom_uses(
+        const Node &atom,
+        LiveState &uses,
+        const std::shared_ptr<ControlFlow> &cfg) {
         if (atom / Expr == Ident) {
-            return {get_identifier(atom / Expr)};
+            uses.insert(cfg->get_var_id(atom / Expr));
         }
-        return {};
     }
 
-    Vars get_expr_op_defs(const Node &op) {
-        auto lhs = get_atom_defs(op / Lhs);
-        auto rhs = get_atom_defs(op / Rhs);
-        lhs.insert(rhs.begin(), rhs.end());
-
-        return lhs;
+    inline void add_expr_op_uses(
+        const Node &op, LiveState &uses, const std::shared_ptr<ControlFlow> &cfg) {
+        add_atom_uses(op / Lhs, uses, cfg);
+        add_atom_uses(op / Rhs, uses, cfg);
     }
 
-    Vars get_expr_defs(const Node &inst) {
+    inline void add_expr_uses(
+        const Node &inst,
+        LiveState &uses,
+        const std::shared_ptr<ControlFlow> &cfg) {
         if (inst == Atom || inst == BAtom) {
-            return get_atom_defs(inst);
+            add_atom_uses(inst, uses, cfg);
         } else if (inst->type().in({Add, Sub, Mul, And, Or, LT, Equals})) {
-            return get_expr_op_defs(inst);
+            add_expr_op_uses(inst, uses, cfg);
         } else if (inst == Not) {
-            return get_atom_defs(inst / BAtom);
+            add_atom_uses(inst / BAtom, uses, cfg);
         } else if (inst == FunCall) {
             auto args = inst / ArgList;
-            auto defs = Vars();
 
             for (auto arg : *args) {
-                auto arg_expr = (arg / Atom) / Expr;
-                if (arg_expr == Ident) {
-                    auto var = get_identifier(arg_expr);
-                    defs.insert(var);
-                }
+                add_atom_uses(arg / Atom, uses, cfg);
             }
-            return defs;
         } else {
             throw std::runtime_error(
                 "Unexpected token, expected that parent would be an expression"
@@ -47,55 +45,49 @@ namespace whilelang {
     }
 
     struct LiveImpl {
-		using StateTable = NodeMap<LiveState>;
+		using StateTable = InstructionStates<LiveState>;
 
-        static LiveState create_state(Vars) {
-            return {};
+        static LiveState create_state(const Vars &vars) {
+            return LiveState(vars.size());
         }
 
         static bool state_join(LiveState &s1, const LiveState &s2) {
-            bool changed = s1 != s2;
-            s1.insert(s2.begin(), s2.end());
+            if (s1.size() != s2.size()) {
+                throw std::runtime_error("States are not comparable");
+            }
 
-            return changed;
+            return s1.join(s2);
         }
 
-        static Vars flow(
+        static LiveState flow(
             const Node &inst,
             StateTable &state_table,
-            std::shared_ptr<ControlFlow>) {
-            Vars new_defs = state_table[inst];
-            Vars gen_defs = {};
+            std::shared_ptr<ControlFlow> cfg) {
+            LiveState new_defs = state_table[inst];
 
             if (inst == Assign) {
                 auto rhs = inst / Rhs;
-                auto var = get_identifier(inst / Ident);
 
-                gen_defs = get_expr_defs(rhs / Expr);
-
-                new_defs.erase(var);
+                new_defs.erase(cfg->get_var_id(inst / Ident));
+                add_expr_uses(rhs / Expr, new_defs, cfg);
             } else if (inst->type().in({Output, Return})) {
-                gen_defs = get_atom_defs(inst / Atom);
+                add_atom_uses(inst / Atom, new_defs, cfg);
             } else if (inst == BExpr) {
                 auto expr = inst / Expr;
                 if (expr->type().in({LT, Equals})) {
-                    gen_defs = get_expr_op_defs(expr);
+                    add_expr_op_uses(expr, new_defs, cfg);
                 }
             } else if (inst == BAtom) {
-                gen_defs = get_atom_defs(inst);
-            } else if (inst == Skip) {
-                return new_defs;
+                add_atom_uses(inst, new_defs, cfg);
             }
-            new_defs.insert(gen_defs.begin(), gen_defs.end());
             return new_defs;
         };
     };
 
-    std::ostream &operator<<(std::ostream &os, const LiveState &state) {
+    inline std::ostream &
+    operator<<(std::ostream &os, const LiveState &state) {
         os << "{ ";
-        for (const auto &var : state) {
-            os << var << " ";
-        }
+        state.for_each([&](size_t var) { os << var << " "; });
         os << "}";
         return os;
     }
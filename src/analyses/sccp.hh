@@ -0,0 +1,311 @@
+#pragma once
+#include "../ssa.hh"
+#include "constant_propagation.hh"
+
+namespace whilelang {
+    // Sparse conditional constant propagation over the SSA form of the
+    // program. Every SSA value holds one lattice value, and instructions
+    // are only evaluated once an edge reaching them is known to be taken.
+    // Calls join their arguments into the parameters of the callee, and
+    // returns join into one return value per function, so the analysis is
+    // interprocedural but does not distinguish calling contexts.
+    class SCCP {
+      public:
+        void run(std::shared_ptr<ControlFlow> cfg);
+
+        // Value of var read by the instruction. Instructions that are
+        // never executed read bottom
+        CPLatticeValue value_at(const Node &inst, VarId var) const;
+
+        inline bool is_executable(uint32_t inst) const {
+            return executable[inst];
+        };
+
+        inline size_t get_evaluations() const {
+            return evaluations;
+        };
+
+        void log(std::shared_ptr<ControlFlow> cfg) const;
+
+      private:
+        std::shared_ptr<ControlFlow> cfg;
+        SSA ssa;
+        std::vector<CPLatticeValue> values;
+        std::vector<uint8_t> executable;
+        // Executable incoming edges, in the order of the intraprocedural
+        // predecessors
+        std::vector<std::vector<uint8_t>> executable_edges;
+        std::vector<CPLatticeValue> returns;
+        std::vector<uint32_t> fun_defs;
+        std::vector<uint32_t> worklist;
+        std::vector<uint8_t> queued;
+        size_t evaluations = 0;
+
+        void push(uint32_t inst);
+        void mark_edge(uint32_t from, uint32_t to);
+        void update(SSA::Value value, const CPLatticeValue &lattice_value);
+        void evaluate(uint32_t inst);
+
+        CPLatticeValue read(uint32_t inst, const Node &atom) const;
+        CPLatticeValue evaluate_expr(uint32_t inst, const Node &expr) const;
+        std::vector<SSA::Value> params_of(uint32_t fun_def) const;
+    };
+
+    inline void SCCP::run(std::shared_ptr<ControlFlow> cfg) {
+        this->cfg = cfg;
+        ssa = SSA(cfg);
+
+        const size_t n = cfg->get_instructions().size();
+        const auto &function_of = cfg->get_function_partition();
+
+        values.assign(ssa.size(), CPLatticeValue::bottom());
+        executable.assign(n, 0);
+        executable_edges.assign(n, {});
+        returns.assign(cfg->get_function_count(), CPLatticeValue::bottom());
+        fun_defs.assign(cfg->get_function_count(), 0);
+        queued.assign(n, 0);
+        worklist.clear();
+        evaluations = 0;
+
+        for (uint32_t i = 0; i < n; i++) {
+            executable_edges[i].assign(cfg->intraprocedural_predecessors(i).size(), 0);
+
+            if (cfg->get_instruction(i) == FunDef) {
+                fun_defs[function_of[i]] = i;
+            }
+        }
+
+        // The program starts in main, whose parameters are unknown
+        uint32_t entry = cfg->get_index(cfg->get_program_entry());
+        for (SSA::Value param : params_of(entry)) {
+            update(param, CPLatticeValue::top());
+        }
+        executable[entry] = 1;
+        push(entry);
+
+        while (!worklist.empty()) {
+            uint32_t inst = worklist.back();
+            worklist.pop_back();
+            queued[inst] = 0;
+
+            evaluate(inst);
+        }
+
+        logging::Debug() << "Sparse constant propagation evaluated "
+                         << evaluations << " instructions";
+    }
+
+    inline CPLatticeValue SCCP::value_at(const Node &inst, VarId var) const {
+        uint32_t i = cfg->get_index(inst);
+
+        if (!executable[i]) {
+            return CPLatticeValue::bottom();
+        }
+
+        SSA::Value value = ssa.use(i, var);
+        return value == SSA::undefined ? CPLatticeValue::top() : values[value];
+    }
+
+    inline void SCCP::log(std::shared_ptr<ControlFlow> cfg) const {
+        std::stringstream str_builder;
+        const Vars &vars = cfg->get_vars();
+
+        for (SSA::Value v = 0; v < values.size(); v++) {
+            const auto &def = ssa.definition(v);
+            str_builder << vars.name(def.var) << "@" << def.inst + 1 << " = "
+                        << values[v] << std::endl;
+        }
+        logging::Debug() << str_builder.str();
+    }
+
+    // Private
+
+    inline void SCCP::push(uint32_t inst) {
+        if (executable[inst] && !queued[inst]) {
+            queued[inst] = 1;
+            worklist.push_back(inst);
+        }
+    }
+
+    inline void SCCP::mark_edge(uint32_t from, uint32_t to) {
+        auto preds = cfg->intraprocedural_predecessors(to);
+        size_t pos = std::find(preds.begin(), preds.end(), from) - preds.begin();
+
+        if (executable_edges[to][pos]) {
+            return;
+        }
+        executable_edges[to][pos] = 1;
+        executable[to] = 1;
+
+        // The phis of an executed instruction gained an argument
+        push(to);
+    }
+
+    inline void SCCP::update(
+        SSA::Value value, const CPLatticeValue &lattice_value) {
+        CPLatticeValue joined = values[value].join(lattice_value);
+
+        if (joined == values[value]) {
+            return;
+        }
+        values[value] = joined;
+
+        for (uint32_t user : ssa.users(value)) {
+            push(user);
+        }
+        for (SSA::Value phi : ssa.phi_users(value)) {
+            push(ssa.definition(phi).inst);
+        }
+    }
+
+    inline void SCCP::evaluate(uint32_t inst) {
+        const Node &node = cfg->get_instruction(inst);
+        const auto &function_of = cfg->get_function_partition();
+        auto preds = cfg->intraprocedural_predecessors(inst);
+        evaluations++;
+
+        for (SSA::Value value : ssa.defined_at(inst)) {
+            const auto &def = ssa.definition(value);
+
+            if (def.kind != SSA::DefKind::Phi) {
+                continue;
+            }
+
+            CPLatticeValue joined = CPLatticeValue::bottom();
+            for (size_t pos = 0; pos < preds.size(); pos++) {
+                if (!executable_edges[inst][pos]) {
+                    continue;
+                }
+
+                SSA::Value arg = def.args[pos];
+                joined = joined.join(
+                    arg == SSA::undefined ? CPLatticeValue::top()
+                                          : values[arg]);
+            }
+            update(value, joined);
+        }
+
+        if (node == Assign) {
+            auto expr = (node / Rhs) / Expr;
+            const auto &defs = ssa.defined_at(inst);
+
+            if (expr == FunCall) {
+                uint32_t callee = cfg->get_index(cfg->get_fun_def(expr));
+                update(defs.back(), returns[function_of[callee]]);
+            } else {
+                update(defs.back(), evaluate_expr(inst, expr));
+            }
+        } else if (node == FunCall) {
+            uint32_t callee = cfg->get_index(cfg->get_fun_def(node));
+            auto params = params_of(callee);
+            auto args = node / ArgList;
+
+            for (size_t i = 0; i < params.size(); i++) {
+                update(params[i], read(inst, args->at(i) / Atom));
+            }
+
+            if (!executable[callee]) {
+                executable[callee] = 1;
+                push(callee);
+            }
+        } else if (node == Return) {
+            uint32_t fun = function_of[inst];
+            CPLatticeValue joined = returns[fun].join(read(inst, node / Atom));
+
+            if (!(joined == returns[fun])) {
+                returns[fun] = joined;
+                auto fun_def = cfg->get_instruction(fun_defs[fun]);
+
+                for (auto fun_call : cfg->get_fun_calls_from_def(fun_def)) {
+                    push(cfg->get_index(fun_call->parent(Assign)));
+                }
+            }
+            return;
+        } else if (node == BAtom) {
+            CPLatticeValue cond = read(inst, node);
+
+            if (cond.type == CPAbstractType::Bottom) {
+                return;
+            }
+
+            if (cond.type == CPAbstractType::Constant) {
+                // A true condition leads into Then or Do. A false one leads
+                // into Else, or out of the loop along every other edge
+                Node branch = node->parent();
+                bool truthy = *cond.value != 0;
+                Node target_stmt = branch == While ? branch / Do
+                    : truthy                       ? branch / Then
+                                                   : branch / Else;
+                uint32_t target =
+                    cfg->get_index(get_first_basic_child(target_stmt));
+
+                for (uint32_t succ : cfg->intraprocedural_successors(inst)) {
+                    if ((succ == target) == (branch == If || truthy)) {
+                        mark_edge(inst, succ);
+                    }
+                }
+                return;
+            }
+        }
+
+        for (uint32_t succ : cfg->intraprocedural_successors(inst)) {
+            mark_edge(inst, succ);
+        }
+    }
+
+    inline CPLatticeValue
+    SCCP::read(uint32_t inst, const Node &atom) const {
+        Node expr = atom / Expr;
+
+        if (expr == Int) {
+            return CPLatticeValue::constant(get_int_value(expr));
+        } else if (expr == True || expr == False) {
+            return CPLatticeValue::constant(expr == True ? 1 : 0);
+        } else if (expr == Ident) {
+            SSA::Value value = ssa.use(inst, cfg->get_var_id(expr));
+            return value == SSA::undefined ? CPLatticeValue::top()
+                                           : values[value];
+        }
+
+        return CPLatticeValue::top();
+    }
+
+    inline CPLatticeValue
+    SCCP::evaluate_expr(uint32_t inst, const Node &expr) const {
+        if (expr == Atom || expr == BAtom) {
+            return read(inst, expr);
+        } else if (expr == Not) {
+            auto value = read(inst, expr / BAtom);
+
+            if (value.type == CPAbstractType::Constant) {
+                return CPLatticeValue::constant(*value.value == 1 ? 0 : 1);
+            }
+            return value;
+        }
+
+        auto lhs = read(inst, expr / Lhs);
+        auto rhs = read(inst, expr / Rhs);
+
+        if (lhs.type == CPAbstractType::Constant &&
+            rhs.type == CPAbstractType::Constant) {
+            return CPLatticeValue::constant(
+                apply_op(expr, *lhs.value, *rhs.value));
+        } else if (
+            lhs.type == CPAbstractType::Bottom ||
+            rhs.type == CPAbstractType::Bottom) {
+            return CPLatticeValue::bottom();
+        }
+        return CPLatticeValue::top();
+    }
+
+    inline std::vector<SSA::Value> SCCP::params_of(uint32_t fun_def) const {
+        std::vector<SSA::Value> params;
+
+        for (SSA::Value value : ssa.defined_at(fun_def)) {
+            if (ssa.definition(value).kind == SSA::DefKind::Param) {
+                params.push_back(value);
+            }
+        }
+        return params;
+    }
+}
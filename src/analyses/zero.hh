@@ -4,7 +4,14 @@
 
 namespace whilelang {
 
-    enum class ZeroAbstractType { Bottom, Zero, NonZero, Top };
+    // The codes are chosen such that the join of two types is their bitwise
+    // or, which lets ZeroState pack them two bits per variable
+    enum class ZeroAbstractType : uint8_t {
+        Bottom = 0b00,
+        Zero = 0b01,
+        NonZero = 0b10,
+        Top = 0b11
+    };
 
     struct ZeroLatticeValue {
         ZeroAbstractType type;
@@ -14,22 +21,8 @@ namespace whilelang {
         }
 
         ZeroLatticeValue join(const ZeroLatticeValue &other) const {
-            auto top = ZeroLatticeValue::top();
-            auto zero = ZeroLatticeValue::zero();
-            auto non_zero = ZeroLatticeValue::non_zero();
-            auto bottom = ZeroLatticeValue::bottom();
-
-            if (*this == bottom) {
-                return other;
-            } else if (other == bottom) {
-                return *this;
-            } else if (*this == zero && other == zero) {
-                return zero;
-            } else if (*this == non_zero && other == non_zero) {
-                return non_zero;
-            }
-
-            return top;
+            return {static_cast<ZeroAbstractType>(
+                static_cast<uint8_t>(type) | static_cast<uint8_t>(other.type))};
         }
 
         friend std::ostream &
@@ -65,54 +58,86 @@ namespace whilelang {
         }
     };
 
-    using ZeroState = std::map<std::string, ZeroLatticeValue>;
+    // Packed zero analysis state, two bits per variable
+    class ZeroState {
+      public:
+        ZeroState() = default;
+
+        ZeroState(size_t size, ZeroLatticeValue value)
+        : codes(size, static_cast<uint8_t>(value.type)) {}
+
+        size_t size() const {
+            return codes.size();
+        }
+
+        ZeroLatticeValue get(size_t i) const {
+            return {static_cast<ZeroAbstractType>(codes.get(i))};
+        }
+
+        void set(size_t i, ZeroLatticeValue value) {
+            codes.set(i, static_cast<uint8_t>(value.type));
+        }
 
-    ZeroLatticeValue handle_atom(const Node atom, ZeroState &incoming_state) {
+        bool join(const ZeroState &other) {
+            return codes.join(other.codes);
+        }
+
+        bool operator==(const ZeroState &other) const = default;
+
+      private:
+        CodeVector codes;
+    };
+
+    inline ZeroLatticeValue handle_atom(
+        const Node atom,
+        const ZeroState &incoming_state,
+        const std::shared_ptr<ControlFlow> &cfg) {
         if (atom == Int) {
             return get_int_value(atom) == 0 ? ZeroLatticeValue::zero() :
                                               ZeroLatticeValue::non_zero();
         } else if (atom == Ident) {
-            std::string rhs_var = get_identifier(atom);
-            return incoming_state[rhs_var];
+            return incoming_state.get(cfg->get_var_id(atom));
         } else {
             return ZeroLatticeValue::top();
         }
     };
 
+    // Zero abstraction of an arithmetic expression. Multiplying two non
+    // zero values may overflow to zero, so only a zero factor is certain
+    inline ZeroLatticeValue handle_arithmetic(
+        const Node op,
+        const ZeroState &incoming_state,
+        const std::shared_ptr<ControlFlow> &cfg) {
+        auto lhs = handle_atom((op / Lhs) / Expr, incoming_state, cfg);
+        auto rhs = handle_atom((op / Rhs) / Expr, incoming_state, cfg);
+        auto zero = ZeroLatticeValue::zero();
+
+        if (lhs == ZeroLatticeValue::bottom() ||
+            rhs == ZeroLatticeValue::bottom()) {
+            return ZeroLatticeValue::bottom();
+        } else if (op == Mul && (lhs == zero || rhs == zero)) {
+            return zero;
+        } else if (op == Add && lhs == zero) {
+            return rhs;
+        } else if (op->type().in({Add, Sub}) && rhs == zero) {
+            return lhs;
+        }
+        return ZeroLatticeValue::top();
+    }
+
     struct ZeroImpl {
-		using StateTable = NodeMap<ZeroState>;
+		using StateTable = InstructionStates<ZeroState>;
 
         static ZeroState create_state(const Vars &vars) {
-            ZeroState state = ZeroState();
-
-            for (auto var : vars) {
-                state[var] = ZeroLatticeValue::bottom();
-            }
-            return state;
+            return ZeroState(vars.size(), ZeroLatticeValue::bottom());
         }
 
         static bool state_join(ZeroState &x, const ZeroState &y) {
-            bool changed = false;
-
-            auto it1 = x.begin();
-            auto it2 = y.begin();
-
-            while (it1 != x.end() && it2 != y.end()) {
-                auto join_res = it1->second.join(it2->second);
-
-                if (join_res != it1->second) {
-                    it1->second = join_res;
-                    changed = true;
-                }
-                it1++;
-                it2++;
-            }
-
-            if (it1 != x.end() || it2 != y.end()) {
+            if (x.size() != y.size()) {
                 throw std::runtime_error("States are not comparable");
             }
 
-            return changed;
+            return x.join(y);
         }
 
         static ZeroState flow(
@@ -121,26 +146,37 @@ namespace whilelang {
             std::shared_ptr<ControlFlow> cfg) {
             auto incoming_state = state_table[inst];
             if (inst == Assign) {
-                auto var = get_identifier(inst / Ident);
+                VarId var = cfg->get_var_id(inst / Ident);
                 Node rhs = (inst / Rhs) / Expr;
 
                 if (rhs == Atom) {
                     auto atom = rhs / Expr;
-                    incoming_state[var] = handle_atom(atom, incoming_state);
+                    incoming_state.set(
+                        var, handle_atom(atom, incoming_state, cfg));
+                } else if (rhs->type().in({Add, Sub, Mul})) {
+                    incoming_state.set(
+                        var, handle_arithmetic(rhs, incoming_state, cfg));
                 } else if (rhs == FunCall) {
-                    auto prevs = cfg->predecessors(inst);
+                    auto prevs = cfg->predecessor_indices(cfg->get_index(inst));
                     ZeroLatticeValue val = ZeroLatticeValue::bottom();
 
-                    for (auto node : prevs) {
+                    for (uint32_t prev : prevs) {
+                        const Node &node = cfg->get_instruction(prev);
+
+                        // The returned value is read in the state of the
+                        // callee at the return, not the joined state
                         if (node == Return) {
                             val = val.join(handle_atom(
-                                (node / Atom) / Expr, incoming_state));
+                                (node / Atom) / Expr, state_table[node], cfg));
                         }
                     }
 
                     auto pre_fun_call_state = state_table[rhs];
-                    pre_fun_call_state[var] = val;
+                    pre_fun_call_state.set(var, val);
                     return pre_fun_call_state;
+                } else {
+                    // Boolean expressions are not tracked
+                    incoming_state.set(var, ZeroLatticeValue::top());
                 }
             } else if (inst == FunCall) {
                 auto params = cfg->get_fun_def(inst) / ParamList;
@@ -149,10 +185,10 @@ namespace whilelang {
                 for (size_t i = 0; i < params->size(); i++) {
                     auto param_id = params->at(i) / Ident;
                     auto arg = args->at(i) / Atom;
-                    auto var = get_identifier(param_id);
 
-                    incoming_state[var] =
-                        handle_atom(arg / Expr, incoming_state);
+                    incoming_state.set(
+                        cfg->get_var_id(param_id),
+                        handle_atom(arg / Expr, incoming_state, cfg));
                 }
             }
 
@@ -160,9 +196,10 @@ namespace whilelang {
         }
     };
 
-    std::ostream &operator<<(std::ostream &os, const ZeroState &state) {
-        for (const auto &[_, value] : state) {
-            os << std::setw(PRINT_WIDTH) << value;
+    inline std::ostream &
+    operator<<(std::ostream &os, const ZeroState &state) {
+        for (size_t i = 0; i < state.size(); i++) {
+            os << std::setw(PRINT_WIDTH) << state.get(i);
         }
         return os;
     }
@@ -15,4 +15,30 @@ namespace whilelang {
             whilelang::normalization_wf
         };
     }
+
+    Rewriter bytecode_compiler(std::shared_ptr<vm::Program> program) {
+        return {
+            "bytecode_compiler",
+            {
+                to3addr(),
+                gather_vars(),
+                blockify(),
+                lower_bytecode(program),
+            },
+            whilelang::normalization_wf
+        };
+    }
+
+    Rewriter c_compiler(std::shared_ptr<std::string> source) {
+        return {
+            "c_compiler",
+            {
+                to3addr(),
+                gather_vars(),
+                blockify(),
+                emit_c(source),
+            },
+            whilelang::normalization_wf
+        };
+    }
 }
@@ -8,12 +8,13 @@ namespace whilelang {
     // Public
     ControlFlow::ControlFlow() {
         this->instructions = Nodes();
-        this->vars = Vars();
+        this->vars.clear();
         this->predecessor = NodeMap<NodeSet>();
         this->successor = NodeMap<NodeSet>();
         this->fun_call_to_def = NodeMap<Node>();
         this->fun_def_to_calls = NodeMap<NodeSet>();
         this->dirty_flag = false;
+        this->frozen = false;
     }
 
     void ControlFlow::clear() {
@@ -23,11 +24,81 @@ namespace whilelang {
         successor.clear();
         fun_call_to_def.clear();
         fun_def_to_calls.clear();
+        frozen = false;
+        instruction_index.clear();
+        successor_csr = CSRGraph();
+        predecessor_csr = CSRGraph();
+        intra_successor_csr = CSRGraph();
+        intra_predecessor_csr = CSRGraph();
+        dominator_tree.reset();
+        loop_forest.reset();
+        function_of.clear();
+        function_count = 0;
+        removals.clear();
+        change_log.clear();
+        generation++;
     }
 
-    void ControlFlow::add_var(Node ident) {
-        vars.insert(get_identifier(ident));
-    };
+    const NodeSet &ControlFlow::successors(const Node &node) const {
+        static const NodeSet no_successors;
+        auto res = successor.find(node);
+
+        return res == successor.end() ? no_successors : res->second;
+    }
+
+    const NodeSet &ControlFlow::predecessors(const Node &node) const {
+        static const NodeSet no_predecessors;
+        auto res = predecessor.find(node);
+
+        return res == predecessor.end() ? no_predecessors : res->second;
+    }
+
+    void ControlFlow::freeze() {
+        instruction_index.clear();
+        instruction_index.reserve(instructions.size());
+
+        for (size_t i = 0; i < instructions.size(); i++) {
+            instruction_index.insert({instructions[i].get(), i});
+        }
+
+        successor_csr = to_csr(successor);
+        predecessor_csr = to_csr(predecessor);
+
+        // Instructions are gathered top down, so the body of a function
+        // directly follows its definition
+        function_of.resize(instructions.size());
+        function_count = 0;
+
+        for (size_t i = 0; i < instructions.size(); i++) {
+            if (instructions[i] == FunDef) {
+                function_count++;
+            }
+            function_of[i] = function_count == 0 ? 0 : function_count - 1;
+        }
+
+        build_intraprocedural_edges();
+        dominator_tree.reset();
+        loop_forest.reset();
+        frozen = true;
+    }
+
+    const DominatorTree &ControlFlow::get_dominator_tree() {
+        if (!frozen) {
+            throw std::runtime_error("Control flow graph is not frozen");
+        }
+
+        if (!dominator_tree) {
+            build_dominator_tree();
+        }
+        return *dominator_tree;
+    }
+
+    const LoopForest &ControlFlow::get_loop_forest() {
+        if (!loop_forest) {
+            build_loop_forest();
+        }
+        return *loop_forest;
+    }
 
     void ControlFlow::add_edge(const Node &u, const Node &v) {
         append_to_nodemap(successor, u, v);
@@ -46,15 +117,17 @@ namespace whilelang {
     // Fill the map with function calls to their definitions
     void ControlFlow::set_functions_calls(
         std::shared_ptr<NodeSet> fun_defs, std::shared_ptr<NodeSet> fun_calls) {
+        std::unordered_map<std::string_view, Node> defs_by_name;
+        for (auto fun_def : *fun_defs) {
+            defs_by_name.insert({(fun_def / FunId)->location().view(), fun_def});
+        }
+
         for (auto fun_call : *fun_calls) {
-            auto call_id_str = get_identifier(fun_call / FunId);
+            auto res = defs_by_name.find((fun_call / FunId)->location().view());
 
-            for (auto fun_def : *fun_defs) {
-                auto fun_def_str = get_identifier(fun_def / FunId);
-                if (call_id_str == fun_def_str) {
-                    append_to_nodemap(fun_def_to_calls, fun_def, fun_call);
-                    fun_call_to_def.insert({fun_call, fun_def});
-                }
+            if (res != defs_by_name.end()) {
+                append_to_nodemap(fun_def_to_calls, res->second, fun_call);
+                fun_call_to_def.insert({fun_call, res->second});
             }
         }
 
@@ -69,6 +142,145 @@ namespace whilelang {
             "No main function found. Please define a main function.");
     }
 
+    void ControlFlow::record_removed_statement(const Node &stmt) {
+        removals.push_back({Removal::Splice, instructions_in(stmt)});
+    }
+
+    void ControlFlow::record_unreachable(const Node &node) {
+        removals.push_back({Removal::Drop, instructions_in(node)});
+    }
+
+    void ControlFlow::apply_changes() {
+        if (removals.empty()) {
+            return;
+        }
+
+        // Calls and returns connect different functions, they are never
+        // reconnected around a removed statement
+        auto is_interprocedural = [](const Node &u, const Node &v) {
+            return (u == FunCall && v == FunDef) || (u == Return && v == Assign);
+        };
+
+        NodeSet removed;
+        NodeSet touched;
+
+        // Removals are applied in the order they were recorded, so a region
+        // is only spliced against edges that still exist
+        for (const auto &[kind, nodes] : removals) {
+            NodeSet region(nodes.begin(), nodes.end());
+            NodeSet entries;
+            NodeSet exits;
+
+            if (kind == Removal::Splice) {
+                for (const auto &inst : region) {
+                    for (const auto &pred : predecessors(inst)) {
+                        if (!region.contains(pred) &&
+                            !is_interprocedural(pred, inst)) {
+                            entries.insert(pred);
+                        }
+                    }
+                    for (const auto &succ : successors(inst)) {
+                        if (!region.contains(succ) &&
+                            !is_interprocedural(inst, succ)) {
+                            exits.insert(succ);
+                        }
+                    }
+                }
+            }
+
+            for (const auto &inst : region) {
+                const NodeSet &preds = predecessors(inst);
+                const NodeSet &succs = successors(inst);
+                touched.insert(preds.begin(), preds.end());
+                touched.insert(succs.begin(), succs.end());
+
+                detach(inst);
+                removed.insert(inst);
+            }
+
+            if (!exits.empty()) {
+                for (const auto &entry : entries) {
+                    add_edge(entry, exits);
+                }
+            }
+        }
+        removals.clear();
+
+        for (auto it = fun_call_to_def.begin(); it != fun_call_to_def.end();) {
+            if (removed.contains(it->first)) {
+                fun_def_to_calls[it->second].erase(it->first);
+                it = fun_call_to_def.erase(it);
+            } else {
+                it++;
+            }
+        }
+
+        std::erase_if(fun_def_to_calls, [&](const auto &entry) {
+            return removed.contains(entry.first);
+        });
+        std::erase_if(instructions, [&](const Node &inst) {
+            return removed.contains(inst);
+        });
+
+        program_exit = get_last_basic_child(program_entry / Body);
+
+        // The neighbours of removed instructions gained or lost edges
+        for (const auto &inst : touched) {
+            if (!removed.contains(inst)) {
+                record_changed(inst);
+            }
+        }
+
+        logging::Debug() << "Patched control flow graph, removed "
+                         << removed.size() << " instructions";
+        freeze();
+    }
+
+    std::vector<uint32_t> ControlFlow::reverse_postorder() const {
+        if (!frozen) {
+            throw std::runtime_error("Control flow graph is not frozen");
+        }
+
+        const size_t n = instructions.size();
+        std::vector<uint32_t> order;
+        std::vector<bool> visited(n, false);
+        std::vector<uint32_t> postorder;
+        std::vector<std::pair<uint32_t, size_t>> stack;
+        order.reserve(n);
+
+        auto walk = [&](uint32_t root) {
+            postorder.clear();
+            visited[root] = true;
+            stack.push_back({root, 0});
+
+            while (!stack.empty()) {
+                auto &[node, next] = stack.back();
+                auto succs = successor_csr.neighbours(node);
+
+                if (next == succs.size()) {
+                    postorder.push_back(node);
+                    stack.pop_back();
+                    continue;
+                }
+
+                uint32_t succ = succs[next++];
+                if (!visited[succ]) {
+                    visited[succ] = true;
+                    stack.push_back({succ, 0});
+                }
+            }
+            order.insert(order.end(), postorder.rbegin(), postorder.rend());
+        };
+
+        walk(get_index(program_entry));
+        for (uint32_t i = 0; i < n; i++) {
+            if (!visited[i]) {
+                walk(i);
+            }
+        }
+        return order;
+    }
+
     void ControlFlow::log_predecessors_and_successors() {
         for (size_t i = 0; i < instructions.size(); i++) {
             auto inst = instructions[i];
@@ -109,8 +321,8 @@ namespace whilelang {
     }
     void ControlFlow::log_variables() {
         logging::Debug() << "Variables: ";
-        for (auto var : vars) {
-            logging::Debug() << var << ",";
+        for (VarId id = 0; id < vars.size(); id++) {
+            logging::Debug() << vars.name(id) << ",";
         }
     }
 
@@ -126,6 +338,343 @@ namespace whilelang {
 
     // Private
 
+    Nodes ControlFlow::instructions_in(const Node &node) const {
+        Nodes result;
+
+        node->traverse([&](Node curr) {
+            if (is_instruction(curr)) {
+                result.push_back(curr);
+            }
+            return true;
+        });
+        return result;
+    }
+
+    void ControlFlow::detach(const Node &inst) {
+        auto succs = successor.find(inst);
+        if (succs != successor.end()) {
+            for (const auto &succ : succs->second) {
+                predecessor[succ].erase(inst);
+            }
+            successor.erase(succs);
+        }
+
+        auto preds = predecessor.find(inst);
+        if (preds != predecessor.end()) {
+            for (const auto &pred : preds->second) {
+                if (pred != inst) {
+                    successor[pred].erase(inst);
+                }
+            }
+            predecessor.erase(preds);
+        }
+    }
+
+    void ControlFlow::build_intraprocedural_edges() {
+        const size_t n = instructions.size();
+        std::vector<uint32_t> pred_count(n, 0);
+
+        intra_successor_csr = CSRGraph();
+        intra_successor_csr.offsets.reserve(n + 1);
+        intra_successor_csr.offsets.push_back(0);
+
+        for (uint32_t i = 0; i < n; i++) {
+            const Node &inst = instructions[i];
+
+            if (inst == FunCall) {
+                uint32_t assign = get_index(inst->parent(Assign));
+                intra_successor_csr.targets.push_back(assign);
+                pred_count[assign]++;
+            } else if (inst != Return) {
+                for (uint32_t succ : successor_csr.neighbours(i)) {
+                    intra_successor_csr.targets.push_back(succ);
+                    pred_count[succ]++;
+                }
+            }
+            intra_successor_csr.offsets.push_back(
+                intra_successor_csr.targets.size());
+        }
+
+        intra_predecessor_csr = CSRGraph();
+        intra_predecessor_csr.offsets.resize(n + 1, 0);
+        for (uint32_t i = 0; i < n; i++) {
+            intra_predecessor_csr.offsets[i + 1] =
+                intra_predecessor_csr.offsets[i] + pred_count[i];
+        }
+
+        std::vector<uint32_t> next(
+            intra_predecessor_csr.offsets.begin(),
+            intra_predecessor_csr.offsets.end() - 1);
+        intra_predecessor_csr.targets.resize(
+            intra_successor_csr.targets.size());
+
+        for (uint32_t i = 0; i < n; i++) {
+            for (uint32_t succ : intra_successor_csr.neighbours(i)) {
+                intra_predecessor_csr.targets[next[succ]++] = i;
+            }
+        }
+    }
+
+    // Iterative dominator algorithm of Cooper, Harvey and Kennedy, run from
+    // the definition of every function
+    void ControlFlow::build_dominator_tree() {
+        const size_t n = instructions.size();
+        constexpr uint32_t none = DominatorTree::none;
+
+        DominatorTree tree;
+        auto &idoms = tree.idom;
+        idoms.assign(n, none);
+
+        std::vector<uint32_t> postorder_number(n, none);
+        std::vector<uint32_t> postorder;
+        std::vector<std::pair<uint32_t, size_t>> stack;
+
+        auto intersect = [&](uint32_t a, uint32_t b) {
+            while (a != b) {
+                while (postorder_number[a] < postorder_number[b]) {
+                    a = idoms[a];
+                }
+                while (postorder_number[b] < postorder_number[a]) {
+                    b = idoms[b];
+                }
+            }
+            return a;
+        };
+
+        for (uint32_t root = 0; root < n; root++) {
+            if (instructions[root] != FunDef) {
+                continue;
+            }
+
+            postorder.clear();
+            postorder_number[root] = 0;
+            stack.push_back({root, 0});
+
+            while (!stack.empty()) {
+                auto &[node, next] = stack.back();
+                auto succs = intra_successor_csr.neighbours(node);
+
+                if (next == succs.size()) {
+                    postorder.push_back(node);
+                    stack.pop_back();
+                    continue;
+                }
+
+                uint32_t succ = succs[next++];
+                if (postorder_number[succ] == none) {
+                    postorder_number[succ] = 0;
+                    stack.push_back({succ, 0});
+                }
+            }
+
+            for (uint32_t i = 0; i < postorder.size(); i++) {
+                postorder_number[postorder[i]] = i;
+            }
+
+            idoms[root] = root;
+            bool changed = true;
+
+            while (changed) {
+                changed = false;
+
+                // Reverse postorder, skipping the root
+                for (size_t i = postorder.size() - 1; i-- > 0;) {
+                    uint32_t b = postorder[i];
+                    uint32_t new_idom = none;
+
+                    for (uint32_t pred : intra_predecessor_csr.neighbours(b)) {
+                        if (idoms[pred] == none) {
+                            continue;
+                        }
+                        new_idom = new_idom == none ? pred
+                                                    : intersect(pred, new_idom);
+                    }
+
+                    if (idoms[b] != new_idom) {
+                        idoms[b] = new_idom;
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        tree.reachable.assign(n, 1);
+        std::vector<uint32_t> child_count(n, 0);
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (idoms[i] == none) {
+                idoms[i] = i;
+                tree.reachable[i] = 0;
+            } else if (idoms[i] != i) {
+                child_count[idoms[i]]++;
+            }
+        }
+
+        tree.children.offsets.resize(n + 1, 0);
+        for (uint32_t i = 0; i < n; i++) {
+            tree.children.offsets[i + 1] =
+                tree.children.offsets[i] + child_count[i];
+        }
+
+        std::vector<uint32_t> next(
+            tree.children.offsets.begin(), tree.children.offsets.end() - 1);
+        tree.children.targets.resize(tree.children.offsets[n]);
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (idoms[i] != i) {
+                tree.children.targets[next[idoms[i]]++] = i;
+            }
+        }
+
+        // Number the trees depth first, so dominance is interval inclusion
+        tree.enter.assign(n, 0);
+        tree.exit.assign(n, 0);
+        uint32_t clock = 0;
+
+        for (uint32_t root = 0; root < n; root++) {
+            if (idoms[root] != root) {
+                continue;
+            }
+
+            tree.enter[root] = clock++;
+            stack.push_back({root, 0});
+
+            while (!stack.empty()) {
+                auto &[node, next] = stack.back();
+                auto children = tree.children.neighbours(node);
+
+                if (next == children.size()) {
+                    tree.exit[node] = clock++;
+                    stack.pop_back();
+                    continue;
+                }
+
+                uint32_t child = children[next++];
+                tree.enter[child] = clock++;
+                stack.push_back({child, 0});
+            }
+        }
+
+        dominator_tree = std::move(tree);
+    }
+
+    // Loops are discovered from the innermost header outwards, visiting
+    // headers in reverse preorder of the dominator tree. A body walk that
+    // runs into an already discovered loop continues from its header
+    void ControlFlow::build_loop_forest() {
+        const DominatorTree &dom = get_dominator_tree();
+        const size_t n = instructions.size();
+        constexpr uint32_t none = LoopForest::none;
+
+        LoopForest forest;
+        auto &loops = forest.loops;
+        auto &loop_of = forest.loop_of;
+        loop_of.assign(n, none);
+
+        std::vector<uint32_t> by_preorder(2 * n, none);
+        for (uint32_t i = 0; i < n; i++) {
+            by_preorder[dom.enter[i]] = i;
+        }
+
+        auto outermost = [&](uint32_t loop) {
+            while (loops[loop].parent != none) {
+                loop = loops[loop].parent;
+            }
+            return loop;
+        };
+
+        std::vector<uint32_t> stack;
+
+        for (size_t k = by_preorder.size(); k-- > 0;) {
+            uint32_t header = by_preorder[k];
+
+            if (header == none || !dom.reachable[header]) {
+                continue;
+            }
+
+            for (uint32_t pred : intra_predecessor_csr.neighbours(header)) {
+                if (dom.reachable[pred] && dom.dominates(header, pred)) {
+                    stack.push_back(pred);
+                }
+            }
+
+            if (stack.empty()) {
+                continue;
+            }
+
+            uint32_t loop = loops.size();
+            loops.push_back({header, none, 0, {}});
+            loop_of[header] = loop;
+
+            while (!stack.empty()) {
+                uint32_t inst = stack.back();
+                stack.pop_back();
+
+                if (loop_of[inst] == none) {
+                    loop_of[inst] = loop;
+
+                    for (uint32_t pred :
+                         intra_predecessor_csr.neighbours(inst)) {
+                        if (dom.reachable[pred]) {
+                            stack.push_back(pred);
+                        }
+                    }
+                    continue;
+                }
+
+                uint32_t inner = outermost(loop_of[inst]);
+                if (inner == loop) {
+                    continue;
+                }
+
+                // Enter the nested loop through its header
+                loops[inner].parent = loop;
+                uint32_t inner_header = loops[inner].header;
+
+                for (uint32_t pred :
+                     intra_predecessor_csr.neighbours(inner_header)) {
+                    if (dom.reachable[pred] &&
+                        !dom.dominates(inner_header, pred)) {
+                        stack.push_back(pred);
+                    }
+                }
+            }
+        }
+
+        // Enclosing loops are discovered after the loops they contain
+        for (size_t l = loops.size(); l-- > 0;) {
+            uint32_t parent = loops[l].parent;
+            loops[l].depth = parent == none ? 1 : loops[parent].depth + 1;
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            for (uint32_t l = loop_of[i]; l != none; l = loops[l].parent) {
+                loops[l].body.push_back(i);
+            }
+        }
+
+        logging::Debug() << "Found " << loops.size() << " loops";
+        loop_forest = std::move(forest);
+    }
+
+    CSRGraph ControlFlow::to_csr(const NodeMap<NodeSet> &edges) const {
+        CSRGraph graph;
+        graph.offsets.reserve(instructions.size() + 1);
+        graph.offsets.push_back(0);
+
+        for (const auto &inst : instructions) {
+            auto res = edges.find(inst);
+
+            if (res != edges.end()) {
+                for (const auto &target : res->second) {
+                    graph.targets.push_back(get_index(target));
+                }
+            }
+            graph.offsets.push_back(graph.targets.size());
+        }
+        return graph;
+    }
+
     void ControlFlow::append_to_nodemap(
         NodeMap<NodeSet> &map, const Node &key, const Node &value) {
         auto res = map.find(key);
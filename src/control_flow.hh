@@ -1,10 +1,76 @@
 #pragma once
+#include <optional>
+#include <span>
+
 #include "lang.hh"
+#include "symbol_table.hh"
 
 namespace whilelang {
     using namespace trieste;
 
-    using Vars = std::set<std::string>;
+    using Vars = SymbolTable;
+
+    // Adjacency lists in compressed sparse row form. The neighbours of
+    // vertex i are targets[offsets[i]] up to targets[offsets[i + 1]]
+    struct CSRGraph {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> targets;
+
+        inline std::span<const uint32_t> neighbours(size_t i) const {
+            return {targets.data() + offsets[i], targets.data() + offsets[i + 1]};
+        }
+    };
+
+    // Dominator tree of the intraprocedural flow graph, with one tree per
+    // function rooted at its definition
+    struct DominatorTree {
+        static constexpr uint32_t none = UINT32_MAX;
+
+        // Function definitions and instructions that cannot be reached
+        // from them are their own immediate dominator
+        std::vector<uint32_t> idom;
+        CSRGraph children;
+        std::vector<uint8_t> reachable;
+
+        // Depth-first interval of every instruction in the tree
+        std::vector<uint32_t> enter;
+        std::vector<uint32_t> exit;
+
+        inline bool dominates(uint32_t a, uint32_t b) const {
+            return enter[a] <= enter[b] && exit[b] <= exit[a];
+        }
+    };
+
+    struct Loop {
+        uint32_t header;
+        // Enclosing loop, none for outermost loops
+        uint32_t parent;
+        // Outermost loops have depth 1
+        uint32_t depth;
+        // Every instruction of the loop and its nested loops, sorted
+        std::vector<uint32_t> body;
+    };
+
+    // Natural loops of the intraprocedural flow graph, a loop being the
+    // target of a back edge together with the instructions that reach the
+    // back edge without passing through it
+    struct LoopForest {
+        static constexpr uint32_t none = UINT32_MAX;
+
+        // Nested loops come before the loops enclosing them
+        std::vector<Loop> loops;
+        // Innermost loop of every instruction
+        std::vector<uint32_t> loop_of;
+
+        inline bool contains(uint32_t loop, uint32_t inst) const {
+            for (uint32_t l = loop_of[inst]; l != none; l = loops[l].parent) {
+                if (l == loop) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
 
     class ControlFlow {
       public:
@@ -12,14 +78,109 @@ namespace whilelang {
 
         void clear();
 
-        inline const NodeSet &successors(const Node &node) {
-            return successor[node];
+        const NodeSet &successors(const Node &node) const;
+
+        const NodeSet &predecessors(const Node &node) const;
+
+        // Index of an instruction, its position in get_instructions.
+        // Only available once the graph is frozen
+        inline uint32_t get_index(const Node &inst) const {
+            auto res = instruction_index.find(inst.get());
+
+            if (res == instruction_index.end()) {
+                throw std::runtime_error("Node is not an instruction");
+            }
+            return res->second;
+        };
+
+        inline const Node &get_instruction(size_t index) const {
+            return instructions[index];
+        };
+
+        inline std::span<const uint32_t> successor_indices(size_t index) const {
+            return successor_csr.neighbours(index);
+        };
+
+        inline std::span<const uint32_t>
+        predecessor_indices(size_t index) const {
+            return predecessor_csr.neighbours(index);
+        };
+
+        // Edges within a function. Calls continue with the assignment of
+        // their result instead of entering the callee, and returns have no
+        // successors
+        inline std::span<const uint32_t>
+        intraprocedural_successors(size_t index) const {
+            return intra_successor_csr.neighbours(index);
+        };
+
+        inline std::span<const uint32_t>
+        intraprocedural_predecessors(size_t index) const {
+            return intra_predecessor_csr.neighbours(index);
         };
 
-        inline const NodeSet &predecessors(const Node &node) {
-            return predecessor[node];
+        // Built on first use and kept until the graph changes
+        const DominatorTree &get_dominator_tree();
+        const LoopForest &get_loop_forest();
+
+        inline bool is_frozen() const {
+            return frozen;
+        };
+
+        // Maps every instruction index to the function containing it.
+        // Functions are numbered in the order of their definitions
+        inline const std::vector<uint32_t> &get_function_partition() const {
+            return function_of;
+        };
+
+        inline size_t get_function_count() const {
+            return function_count;
+        };
+
+        // Numbers the instructions and packs the gathered edges into CSR
+        // arrays. Called once the flow graph is complete
+        void freeze();
+
+        inline bool is_instruction(const Node &node) const {
+            return instruction_index.contains(node.get());
         };
 
+        // Rewriting passes record the statements they remove while the
+        // graph is frozen, apply_changes then patches the graph locally
+        // instead of gathering it again.
+
+        // The statement was removed, control reaching it now continues
+        // with whatever followed it
+        void record_removed_statement(const Node &stmt);
+
+        // The node was removed and can no longer be reached, its edges
+        // are dropped without being reconnected
+        void record_unreachable(const Node &node);
+
+        inline bool has_changes() const {
+            return !removals.empty();
+        };
+
+        // Log of instructions whose flow or surroundings were rewritten.
+        // Analyses remember how much of it they have seen in order to only
+        // solve the affected part of the program again
+        inline void record_changed(const Node &inst) {
+            change_log.push_back(inst);
+        };
+
+        inline const Nodes &get_change_log() const {
+            return change_log;
+        };
+
+        // Changes whenever the graph is gathered from scratch
+        inline size_t get_generation() const {
+            return generation;
+        };
+
+        // Removes the recorded instructions and their edges, updates the
+        // function call maps and program exit, and freezes the graph again
+        void apply_changes();
+
         inline const Nodes &get_instructions() {
             return instructions;
         };
@@ -28,24 +189,36 @@ namespace whilelang {
             return vars;
         };
 
+        // Dense id of a variable, used to address dense analysis states
+        inline VarId get_var_id(const Node &ident) const {
+            return vars.id(ident);
+        };
+
         inline bool is_dirty() {
             return dirty_flag;
         }
 
         inline void set_dirty_flag(bool new_state) {
             dirty_flag = new_state;
+
+            if (new_state) {
+                dominator_tree.reset();
+                loop_forest.reset();
+            }
         }
 
         inline void add_instruction(Node inst) {
             instructions.push_back(inst);
         };
 
-        inline Node get_fun_def(Node fun_call) {
-            return fun_call_to_def[fun_call];
+        inline Node get_fun_def(const Node &fun_call) const {
+            auto res = fun_call_to_def.find(fun_call);
+            return res == fun_call_to_def.end() ? Node{} : res->second;
         };
 
-        inline NodeSet get_fun_calls_from_def(Node fun_def) {
-            return fun_def_to_calls[fun_def];
+        inline NodeSet get_fun_calls_from_def(const Node &fun_def) const {
+            auto res = fun_def_to_calls.find(fun_def);
+            return res == fun_def_to_calls.end() ? NodeSet{} : res->second;
         };
 
         inline Node get_program_entry() {
@@ -56,11 +229,18 @@ namespace whilelang {
             return program_exit;
         };
 
+        // Instruction indices in reverse postorder of a depth-first walk from
+        // the program entry. Instructions not reachable from the entry follow
+        // in the order of their own walks
+        std::vector<uint32_t> reverse_postorder() const;
+
         void set_functions_calls(
             std::shared_ptr<NodeSet> fun_defs,
             std::shared_ptr<NodeSet> fun_calls);
 
-        void add_var(Node ident);
+        inline void add_var(const Node &ident) {
+            vars.intern(ident);
+        };
 
         void add_edge(const Node &u, const Node &v);
         void add_edge(const Node &u, const NodeSet &v);
@@ -82,6 +262,33 @@ namespace whilelang {
         NodeMap<NodeSet> predecessor;
         NodeMap<NodeSet> successor;
 
+        // Frozen form of the graph, see freeze
+        bool frozen;
+        std::unordered_map<const NodeDef *, uint32_t> instruction_index;
+        CSRGraph successor_csr;
+        CSRGraph predecessor_csr;
+        CSRGraph intra_successor_csr;
+        CSRGraph intra_predecessor_csr;
+        std::vector<uint32_t> function_of;
+        size_t function_count = 0;
+
+        CSRGraph to_csr(const NodeMap<NodeSet> &edges) const;
+        void build_intraprocedural_edges();
+
+        std::optional<DominatorTree> dominator_tree;
+        std::optional<LoopForest> loop_forest;
+
+        void build_dominator_tree();
+        void build_loop_forest();
+
+        enum class Removal { Splice, Drop };
+        std::vector<std::pair<Removal, Nodes>> removals;
+        Nodes change_log;
+        size_t generation = 0;
+
+        Nodes instructions_in(const Node &node) const;
+        void detach(const Node &inst);
+
         void append_to_nodemap(
             NodeMap<NodeSet> &map, const Node &key, const Node &value);
         void append_to_nodemap(
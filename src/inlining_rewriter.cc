@@ -3,19 +3,23 @@
 namespace whilelang {
     using namespace trieste;
 
-    Rewriter inlining_rewriter() {
+    Rewriter inlining_rewriter(
+        size_t threshold, size_t budget, bool loop_tail_calls) {
         auto call_graph = std::make_shared<CallGraph>();
         auto cfg = std::make_shared<ControlFlow>();
 
         Rewriter rewriter = {
             "inlining_rewriter",
             {
+                tail_recursion(cfg).cond(
+                    [=](Node) { return loop_tail_calls; }),
+
                 gather_functions(cfg),
                 gather_instructions(cfg),
                 gather_flow_graph(cfg),
 
                 build_call_graph(call_graph),
-                inlining(call_graph, cfg),
+                inlining(call_graph, cfg, threshold, budget),
             },
             whilelang::normalization_wf,
         };
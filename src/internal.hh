@@ -29,21 +29,37 @@ namespace whilelang {
 
     // Static analysis
     PassDef z_analysis(std::shared_ptr<ControlFlow> cfg);
-    PassDef constant_folding(std::shared_ptr<ControlFlow> cfg);
-    PassDef dead_code_elimination(std::shared_ptr<ControlFlow> cfg);
+    PassDef interval_analysis(std::shared_ptr<ControlFlow> cfg);
+    PassDef constant_folding(std::shared_ptr<ControlFlow> cfg, size_t threads);
+    PassDef sccp(std::shared_ptr<ControlFlow> cfg);
+    PassDef algebraic_simplification(std::shared_ptr<ControlFlow> cfg);
+    PassDef global_value_numbering(std::shared_ptr<ControlFlow> cfg);
+    PassDef copy_propagation(std::shared_ptr<ControlFlow> cfg);
+    PassDef dead_code_elimination(
+        std::shared_ptr<ControlFlow> cfg, size_t threads);
     PassDef dead_code_cleanup();
+    PassDef loop_invariant_code_motion(
+        std::shared_ptr<ControlFlow> cfg, size_t threads);
+    PassDef strength_reduction(std::shared_ptr<ControlFlow> cfg);
 
 	// Inlining
+    PassDef tail_recursion(std::shared_ptr<ControlFlow> cfg);
+    PassDef specialization(
+        std::shared_ptr<ControlFlow> cfg, size_t inline_threshold);
     PassDef build_call_graph(std::shared_ptr<CallGraph> call_graph);
     PassDef inlining(
         std::shared_ptr<CallGraph> call_graph,
-        std::shared_ptr<ControlFlow> cfg);
+        std::shared_ptr<ControlFlow> cfg,
+        size_t threshold,
+        size_t budget);
 
 	// Compilation
 	PassDef to3addr();
 	PassDef gather_vars();
 	PassDef blockify();
 	PassDef compile();
+	PassDef lower_bytecode(std::shared_ptr<vm::Program> program);
+	PassDef emit_c(std::shared_ptr<std::string> source);
 
     // clang-format off
 	inline const auto parse_token =
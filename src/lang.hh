@@ -4,14 +4,39 @@
 namespace whilelang {
     using namespace trieste;
 
+    namespace vm {
+        struct Program;
+    }
+
     Reader reader(
         std::shared_ptr<std::map<std::string, std::string>> vars_map,
         bool run_stats,
         bool run_mermaid);
     Rewriter interpret();
-    Rewriter optimization_analysis(bool run_zero_analysis);
-    Rewriter inlining_rewriter();
+
+    // The optional passes of the static analysis, each enabled by a flag
+    // so that its effect can be measured on its own
+    struct OptimizationOptions {
+        bool zero_analysis = false;
+        bool sccp = false;
+        bool interval_analysis = false;
+        bool specialization = false;
+        bool licm = false;
+        bool gvn = false;
+        bool copy_propagation = false;
+        bool simplification = false;
+        bool tail_recursion = false;
+        // Calls costlier than this to inline may be specialized
+        size_t inline_threshold = 40;
+        size_t threads = 1;
+    };
+
+    Rewriter optimization_analysis(const OptimizationOptions &options);
+    Rewriter inlining_rewriter(
+        size_t threshold, size_t budget, bool loop_tail_calls);
     Rewriter compiler();
+    Rewriter bytecode_compiler(std::shared_ptr<vm::Program> program);
+    Rewriter c_compiler(std::shared_ptr<std::string> source);
 
     // Program
     inline const auto Program = TokenDef("while-program");
@@ -7,3 +7,8 @@ extern "C" [[gnu::used]] [[gnu::retain]] int32_t input()
     std::cin >> value;
     return value;
 }
+
+extern "C" [[gnu::used]] [[gnu::retain]] void output(int32_t value)
+{
+    std::cout << value << std::endl;
+}
@@ -3,27 +3,58 @@
 namespace whilelang {
     using namespace trieste;
 
-    Rewriter optimization_analysis(bool run_zero_analysis) {
+    Rewriter optimization_analysis(const OptimizationOptions &options) {
+        // The control flow graph outlives a single run of the rewriter. It
+        // is only gathered again when a pass could not patch it in place
         auto cfg = std::make_shared<ControlFlow>();
-        auto cfg_is_dirty = [=](Node) { return cfg->is_dirty(); };
-        auto run_zero = [=](Node) { return run_zero_analysis; };
+        auto cfg_is_dirty = [=](Node) {
+            return cfg->is_dirty() || !cfg->is_frozen();
+        };
+        auto enabled = [](bool option) {
+            return [=](Node) { return option; };
+        };
+        const size_t threads = options.threads;
 
         Rewriter rewriter = {
             "optimization_analysis",
             {
-                gather_functions(cfg),
-                gather_instructions(cfg),
-                gather_flow_graph(cfg),
+                tail_recursion(cfg).cond(enabled(options.tail_recursion)),
+
+                gather_functions(cfg).cond(cfg_is_dirty),
+                gather_instructions(cfg).cond(cfg_is_dirty),
+                gather_flow_graph(cfg).cond(cfg_is_dirty),
 
-                z_analysis(cfg).cond(run_zero),
-                constant_folding(cfg),
+                z_analysis(cfg).cond(enabled(options.zero_analysis)),
+                interval_analysis(cfg).cond(
+                    enabled(options.interval_analysis)),
+                constant_folding(cfg, threads).cond(enabled(!options.sccp)),
+                sccp(cfg).cond(enabled(options.sccp)),
+                algebraic_simplification(cfg).cond(
+                    enabled(options.simplification)),
+                global_value_numbering(cfg).cond(enabled(options.gvn)),
+                copy_propagation(cfg).cond(enabled(options.copy_propagation)),
+                specialization(cfg, options.inline_threshold)
+                    .cond(enabled(options.specialization)),
 
                 gather_functions(cfg).cond(cfg_is_dirty),
                 gather_instructions(cfg).cond(cfg_is_dirty),
                 gather_flow_graph(cfg).cond(cfg_is_dirty),
 
-                dead_code_elimination(cfg),
+                dead_code_elimination(cfg, threads),
                 dead_code_cleanup(),
+
+                gather_functions(cfg).cond(cfg_is_dirty),
+                gather_instructions(cfg).cond(cfg_is_dirty),
+                gather_flow_graph(cfg).cond(cfg_is_dirty),
+
+                loop_invariant_code_motion(cfg, threads)
+                    .cond(enabled(options.licm)),
+
+                gather_functions(cfg).cond(cfg_is_dirty),
+                gather_instructions(cfg).cond(cfg_is_dirty),
+                gather_flow_graph(cfg).cond(cfg_is_dirty),
+
+                strength_reduction(cfg).cond(enabled(options.simplification)),
             },
             whilelang::normalization_wf,
         };
@@ -6,21 +6,10 @@
 namespace whilelang {
     using namespace trieste;
 
-    PassDef constant_folding(std::shared_ptr<ControlFlow> cfg) {
+    PassDef constant_folding(std::shared_ptr<ControlFlow> cfg, size_t threads) {
         auto analysis = std::make_shared<
-            DataFlowAnalysis<CPState, CPLatticeValue, CPImpl>>();
-
-        auto fetch_instruction = [=](const Node &n) -> Node {
-            auto curr = n;
-
-            while (!curr->type().in(
-                {If, While, Assign, FunCall, FunDef, Output, Return})) {
-                curr = curr->parent();
-            }
-            if (curr->type().in({If, While}))
-                return curr / BAtom;
-            return curr;
-        };
+            DataFlowAnalysis<CPState, CPLatticeValue, CPImpl>>(true);
+        analysis->set_threads(threads);
 
         PassDef constant_folding = {
             "constant_folding",
@@ -29,11 +18,11 @@ namespace whilelang {
             {
                 In(Atom) * T(Ident)[Ident] >> [=](Match &_) -> Node {
                     auto inst = fetch_instruction(_(Ident));
-                    auto var = get_identifier(_(Ident));
-                    auto lattice_value = analysis->get_state(inst)[var];
+                    auto var = cfg->get_var_id(_(Ident));
+                    auto lattice_value = analysis->get_state(inst).get(var);
 
                     if (lattice_value.type == CPAbstractType::Constant) {
-                        cfg->set_dirty_flag(true);
+                        cfg->record_changed(inst);
                         return create_const_node(*lattice_value.value);
                     } else {
                         return NoChange;
@@ -42,11 +31,11 @@ namespace whilelang {
 
                 In(BAtom) * T(Ident)[Ident] >> [=](Match &_) -> Node {
                     auto inst = fetch_instruction(_(Ident));
-                    auto var = get_identifier(_(Ident));
-                    auto lattice_value = analysis->get_state(inst)[var];
+                    auto var = cfg->get_var_id(_(Ident));
+                    auto lattice_value = analysis->get_state(inst).get(var);
 
                     if (lattice_value.type == CPAbstractType::Constant) {
-                        cfg->set_dirty_flag(true);
+                        cfg->record_changed(inst);
                         return *lattice_value.value? True : False;
                     } else {
                         return NoChange;
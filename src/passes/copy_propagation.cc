@@ -0,0 +1,106 @@
+#include "../internal.hh"
+#include "../ssa.hh"
+#include "../utils.hh"
+
+namespace whilelang {
+    using namespace trieste;
+
+    namespace {
+        // The variable copied by an assignment x = y, if it is one
+        Node copied_ident(const Node &inst) {
+            if (inst != Assign) {
+                return {};
+            }
+
+            Node expr = (inst / Rhs) / Expr;
+            if (expr->type().in({Atom, BAtom}) && expr / Expr == Ident) {
+                return expr / Expr;
+            }
+            return {};
+        }
+    }
+
+    PassDef copy_propagation(std::shared_ptr<ControlFlow> cfg) {
+        // Reads to forward, keyed by the reading instruction and the
+        // variable it reads
+        auto forwards = std::make_shared<
+            std::map<std::pair<const NodeDef *, VarId>, Node>>();
+
+        PassDef copy_propagation = {
+            "copy_propagation",
+            normalization_wf,
+            dir::bottomup | dir::once,
+            {
+                In(Atom, BAtom) * T(Ident)[Ident] >> [=](Match &_) -> Node {
+                    auto inst = fetch_instruction(_(Ident));
+                    auto var = cfg->get_var_id(_(Ident));
+                    auto res = forwards->find({inst.get(), var});
+
+                    if (res == forwards->end()) {
+                        return NoChange;
+                    }
+
+                    cfg->record_changed(inst);
+                    return res->second->clone();
+                },
+            }};
+
+        // A read of x whose value comes from x = y reads y instead, as long
+        // as y still holds the value it had at the copy. Chains of copies
+        // are followed to their source. The copies left without readers
+        // are removed by dead code elimination
+        copy_propagation.pre([=](Node) {
+            forwards->clear();
+
+            SSA ssa(cfg);
+            const size_t chain_limit = 16;
+
+            auto enter = [&](uint32_t i, const auto &reaching) {
+                const Node &inst = cfg->get_instruction(i);
+
+                for (auto [var, value] : ssa.uses(i)) {
+                    Node source;
+
+                    for (size_t step = 0;
+                         step < chain_limit && value != SSA::undefined;
+                         step++) {
+                        const auto &def = ssa.definition(value);
+                        if (def.kind != SSA::DefKind::Assign) {
+                            break;
+                        }
+
+                        Node copied =
+                            copied_ident(cfg->get_instruction(def.inst));
+                        if (!copied) {
+                            break;
+                        }
+
+                        VarId copied_var = cfg->get_var_id(copied);
+                        SSA::Value copied_value =
+                            ssa.use(def.inst, copied_var);
+
+                        if (copied_value == SSA::undefined ||
+                            reaching(copied_var) != copied_value) {
+                            break;
+                        }
+
+                        source = copied;
+                        value = copied_value;
+                    }
+
+                    if (source) {
+                        forwards->insert({{inst.get(), var}, source});
+                    }
+                }
+            };
+
+            ssa.walk(cfg, enter, [](uint32_t) {});
+
+            logging::Debug() << "Forwarding " << forwards->size()
+                             << " copied reads";
+            return 0;
+        });
+
+        return copy_propagation;
+    }
+}
@@ -18,9 +18,11 @@ namespace whilelang {
 
     Node bool_to_bexpr(bool v) { return BAtom << (v ? True : False); };
 
-    PassDef dead_code_elimination(std::shared_ptr<ControlFlow> cfg) {
+    PassDef dead_code_elimination(
+        std::shared_ptr<ControlFlow> cfg, size_t threads) {
         auto analysis = std::make_shared<
-            DataFlowAnalysis<LiveState, std::string, LiveImpl>>();
+            DataFlowAnalysis<LiveState, std::string, LiveImpl>>(true);
+        analysis->set_threads(threads);
 
         PassDef dead_code_elimination =
             {
@@ -32,8 +34,9 @@ namespace whilelang {
                     T(FunDef)[FunDef] >> [=](Match &_) -> Node {
                         auto fun_id = _(FunDef) / FunId;
 
-                        if (get_identifier(fun_id) != "main" &&
+                        if (fun_id->location().view() != "main" &&
                             cfg->get_fun_calls_from_def(_(FunDef)).empty()) {
+                            cfg->record_unreachable(_(FunDef));
                             return {};
                         }
                         return NoChange;
@@ -44,22 +47,26 @@ namespace whilelang {
                             << (T(Assign)[Assign]
                                 << (T(Ident)[Ident] * T(AExpr, BExpr))) >>
                         [=](Match &_) -> Node {
-                        auto id = get_identifier(_(Ident));
+                        auto var = cfg->get_var_id(_(Ident));
                         auto assign = _(Assign);
 
-                        if (analysis->get_state(assign).contains(id)) {
+                        if (analysis->get_state(assign).contains(var)) {
                             return NoChange;
                         } else {
+                            cfg->record_removed_statement(assign);
                             return {};
                         }
                     },
 
                     // Remove empty blocks
                     T(Stmt)[Stmt] << (T(Block)[Block] << End) >>
-                        [](Match &_) -> Node {
+                        [=](Match &_) -> Node {
                         if (_(Stmt)->parent()->in({If, While, FunDef})) {
                             // Make sure fun defs, if and while statements
-                            // don't have their body removed
+                            // don't have their body removed. The new skip
+                            // is not known to the control flow graph, so
+                            // it has to be gathered again
+                            cfg->set_dirty_flag(true);
                             return Stmt << (Block << (Stmt << Skip));
                         }
                         return {};
@@ -67,9 +74,12 @@ namespace whilelang {
 
                     // Remove sequences of skip statements
                     In(Block) *
-                            ((Any[Stmt] * (T(Stmt) << T(Skip))) /
-                             ((T(Stmt) << T(Skip)) * Any[Stmt])) >>
-                        [](Match &_) -> Node { return Reapply << _(Stmt); },
+                            ((Any[Stmt] * (T(Stmt) << T(Skip)[Skip])) /
+                             ((T(Stmt) << T(Skip)[Skip]) * Any[Stmt])) >>
+                        [=](Match &_) -> Node {
+                        cfg->record_removed_statement(_(Skip));
+                        return Reapply << _(Stmt);
+                    },
 
                     // Try to evaluate relational expressions
                     In(BExpr) * T(LT, Equals)[Op] >> [=](Match &_) -> Node {
@@ -79,6 +89,8 @@ namespace whilelang {
                         auto rhs = (op / Rhs) / Expr;
 
                         if (lhs == Int && rhs == Int) {
+                            cfg->record_changed(op->parent(Assign));
+
                             if (op == LT) {
                                 return bool_to_bexpr(
                                     get_int_value(lhs) < get_int_value(rhs));
@@ -101,9 +113,15 @@ namespace whilelang {
                         auto bexpr_value = get_batom_value(batom);
 
                         if (bexpr_value.has_value()) {
+                            // The branch not taken is unreachable, the
+                            // condition falls through to the one taken
                             if (*bexpr_value) {
+                                cfg->record_unreachable(_(Else));
+                                cfg->record_removed_statement(batom);
                                 return Reapply << _(Then);
                             } else {
+                                cfg->record_unreachable(_(Then));
+                                cfg->record_removed_statement(batom);
                                 return Reapply << _(Else);
                             }
                         } else {
@@ -112,7 +130,7 @@ namespace whilelang {
                     },
 
                     // Try to determine branching of while statements
-                    T(Stmt) << (T(While) << (T(Stmt) * T(BAtom)[BAtom])) >>
+                    T(Stmt) << (T(While)[While] << (T(Stmt) * T(BAtom)[BAtom])) >>
                         [=](Match &_) -> Node {
                         auto batom = _(BAtom);
                         auto bexpr_value = get_batom_value(batom);
@@ -121,6 +139,7 @@ namespace whilelang {
                             if (*bexpr_value) {
                                 return NoChange;
                             } else {
+                                cfg->record_removed_statement(_(While));
                                 return {};
                             }
                         } else {
@@ -130,8 +149,19 @@ namespace whilelang {
 
                 }};
 
+        dead_code_elimination.post([=](Node) {
+            // Structural changes the graph cannot patch are gathered again
+            // instead
+            if (cfg->is_dirty()) {
+                return 0;
+            }
+
+            cfg->apply_changes();
+            return 0;
+        });
+
         dead_code_elimination.pre([=](Node) {
-            LiveState first_state = {};
+            LiveState first_state = LiveState(cfg->get_vars().size());
 
             analysis->backward_worklist_algoritm(cfg, first_state);
 
@@ -0,0 +1,269 @@
+#include "../internal.hh"
+#include "../utils.hh"
+
+namespace whilelang {
+    using namespace trieste;
+
+    namespace {
+        // Keeps the letters, digits and underscores of a name, the index in
+        // front keeps names unique that differ in the other characters
+        std::string c_name(
+            const std::string &prefix, size_t index, const std::string &name) {
+            std::string res = prefix + std::to_string(index) + "_";
+            for (char c : name) {
+                res += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+            }
+            return res;
+        }
+
+        class FunctionEmitter {
+          public:
+            FunctionEmitter(
+                const std::map<std::string, std::string> &functions)
+                : functions(functions) {}
+
+            void emit(const Node &fun_def, std::ostream &out) {
+                auto fun_id = get_identifier(fun_def / FunId);
+                auto params = fun_def / ParamList;
+
+                out << "static int32_t " << functions.at(fun_id) << "(";
+                if (params->empty()) {
+                    out << "void";
+                }
+                for (size_t i = 0; i < params->size(); i++) {
+                    out << (i > 0 ? ", " : "") << "int32_t "
+                        << var(params->at(i) / Ident);
+                }
+                out << ") {" << std::endl;
+
+                std::set<std::string> param_names;
+                for (const auto &param : *params) {
+                    param_names.insert(get_identifier(param / Ident));
+                }
+
+                // The labels that are jumped to other than by falling
+                // through to the next block
+                auto blocks = fun_def / Blocks;
+                std::set<std::string> targeted;
+                for (size_t i = 0; i < blocks->size(); i++) {
+                    auto term = blocks->at(i) / Jump;
+                    if (term == Cond) {
+                        targeted.insert(get_identifier(term / Then));
+                        targeted.insert(get_identifier(term / Else));
+                    } else if (
+                        term == Jump &&
+                        (i + 1 == blocks->size() ||
+                         get_identifier(term / Label) !=
+                             get_identifier(blocks->at(i + 1) / Label))) {
+                        targeted.insert(get_identifier(term / Label));
+                    }
+                }
+
+                std::ostringstream body;
+                for (size_t i = 0; i < blocks->size(); i++) {
+                    auto block = blocks->at(i);
+                    auto label = get_identifier(block / Label);
+
+                    if (targeted.contains(label)) {
+                        body << this->label(label) << ":;" << std::endl;
+                    }
+
+                    for (const auto &stmt : *(block / Body)) {
+                        emit_stmt(stmt / Stmt, body);
+                    }
+
+                    auto term = block / Jump;
+                    if (term == Cond) {
+                        body << "    if (" << var(term / Ident) << ") goto "
+                             << this->label(get_identifier(term / Then))
+                             << "; else goto "
+                             << this->label(get_identifier(term / Else))
+                             << ";" << std::endl;
+                    } else if (term == Return) {
+                        body << "    return " << var(term / Ident) << ";"
+                             << std::endl;
+                    } else if (targeted.contains(
+                                   get_identifier(term / Label)) &&
+                               (i + 1 == blocks->size() ||
+                                get_identifier(term / Label) !=
+                                    get_identifier(
+                                        blocks->at(i + 1) / Label))) {
+                        body << "    goto "
+                             << this->label(get_identifier(term / Label))
+                             << ";" << std::endl;
+                    }
+                }
+
+                // Locals start at zero, reading one before it is assigned is
+                // then defined
+                for (const auto &[name, c] : vars) {
+                    if (!param_names.contains(name)) {
+                        out << "    int32_t " << c << " = 0;" << std::endl;
+                    }
+                }
+                for (size_t i = 0; i < scratch; i++) {
+                    out << "    int32_t s" << i << ";" << std::endl;
+                }
+
+                out << body.str() << "}" << std::endl << std::endl;
+            }
+
+          private:
+            const std::map<std::string, std::string> &functions;
+            std::map<std::string, std::string> vars;
+            std::map<std::string, std::string> labels;
+
+            // Number of temporaries holding inputs read by an operand, which
+            // are read into them in order before the statement as the order
+            // C evaluates operands in is unspecified
+            size_t scratch = 0;
+
+            std::string var(const Node &ident) {
+                auto name = get_identifier(ident);
+                auto res = vars.find(name);
+                if (res == vars.end()) {
+                    res = vars.insert({name, c_name("v", vars.size(), name)})
+                              .first;
+                }
+                return res->second;
+            }
+
+            std::string label(const std::string &name) {
+                auto res = labels.find(name);
+                if (res == labels.end()) {
+                    res = labels
+                              .insert({name, c_name("L", labels.size(), name)})
+                              .first;
+                }
+                return res->second;
+            }
+
+            // The C expression of an Atom or BAtom, reading inputs into the
+            // next temporary first
+            std::string
+            operand(const Node &atom, size_t &inputs, std::ostream &out) {
+                Node expr = atom / Expr;
+
+                if (expr == Ident) {
+                    return var(expr);
+                } else if (expr == Int) {
+                    int value = get_int_value(expr);
+                    return value < 0 ? "(" + std::to_string(value) + ")"
+                                     : std::to_string(value);
+                } else if (expr == True || expr == False) {
+                    return expr == True ? "1" : "0";
+                }
+
+                auto tmp = "s" + std::to_string(inputs++);
+                scratch = std::max(scratch, inputs);
+                out << "    " << tmp << " = input();" << std::endl;
+                return tmp;
+            }
+
+            // Arithmetic is done unsigned so that overflow wraps around like
+            // in the VIR backend instead of being undefined
+            std::string expression(const Node &expr, std::ostream &out) {
+                size_t inputs = 0;
+
+                if (expr == Atom || expr == BAtom) {
+                    return operand(expr, inputs, out);
+                } else if (expr == Not) {
+                    return "!" + operand(expr / BAtom, inputs, out);
+                } else if (expr == FunCall) {
+                    std::string args;
+                    for (const auto &arg : *(expr / ArgList)) {
+                        args += (args.empty() ? "" : ", ") +
+                            operand(arg / Atom, inputs, out);
+                    }
+                    return functions.at(get_identifier(expr / FunId)) + "(" +
+                        args + ")";
+                }
+
+                auto lhs = operand(expr / Lhs, inputs, out);
+                auto rhs = operand(expr / Rhs, inputs, out);
+
+                if (expr->type().in({Add, Sub, Mul})) {
+                    auto op = expr == Add ? " + " : expr == Sub ? " - " : " * ";
+                    return "(int32_t)((uint32_t)" + lhs + op + "(uint32_t)" +
+                        rhs + ")";
+                }
+
+                auto op = expr == LT ? " < "
+                    : expr == Equals ? " == "
+                    : expr == And    ? " & "
+                                     : " | ";
+                return lhs + op + rhs;
+            }
+
+            void emit_stmt(const Node &stmt, std::ostream &out) {
+                if (stmt == Skip) {
+                    return;
+                } else if (stmt == Output) {
+                    size_t inputs = 0;
+                    auto value = operand(stmt / Atom, inputs, out);
+                    out << "    output(" << value << ");" << std::endl;
+                    return;
+                }
+
+                auto dst = var(stmt / Ident);
+                auto value = expression((stmt / Rhs) / Expr, out);
+                out << "    " << dst << " = " << value << ";" << std::endl;
+            }
+        };
+    }
+
+    // Emits the program as C, to be compiled with the system C compiler
+    // and linked against the runtime library for input and output. Every
+    // function becomes a C function and every block a label, conditions
+    // become an if with a goto to either branch
+    PassDef emit_c(std::shared_ptr<std::string> source) {
+        PassDef emit_c = {"emit_c", blockify_wf, dir::topdown | dir::once, {}};
+
+        emit_c.post([=](Node ast) {
+            std::map<std::string, std::string> functions;
+            for (const auto &fun_def : *ast->front()) {
+                auto name = get_identifier(fun_def / FunId);
+                functions.insert({name, c_name("f", functions.size(), name)});
+            }
+
+            if (!functions.contains("main")) {
+                throw std::runtime_error("Program has no main function");
+            }
+
+            std::ostringstream out;
+            out << "#include <stdint.h>" << std::endl
+                << std::endl
+                << "// Provided by the runtime library" << std::endl
+                << "int32_t input(void);" << std::endl
+                << "void output(int32_t value);" << std::endl
+                << std::endl;
+
+            for (const auto &fun_def : *ast->front()) {
+                out << "static int32_t "
+                    << functions.at(get_identifier(fun_def / FunId)) << "(";
+                auto params = fun_def / ParamList;
+                if (params->empty()) {
+                    out << "void";
+                }
+                for (size_t i = 0; i < params->size(); i++) {
+                    out << (i > 0 ? ", " : "") << "int32_t";
+                }
+                out << ");" << std::endl;
+            }
+            out << std::endl;
+
+            for (const auto &fun_def : *ast->front()) {
+                FunctionEmitter(functions).emit(fun_def, out);
+            }
+
+            out << "int main(void) {" << std::endl
+                << "    return " << functions.at("main") << "();" << std::endl
+                << "}" << std::endl;
+
+            *source = out.str();
+            return 0;
+        });
+
+        return emit_c;
+    }
+}
@@ -29,6 +29,8 @@ namespace whilelang {
             if (cfg->is_dirty()) {
                 cfg->clear();
             }
+            fun_defs->clear();
+            fun_calls->clear();
             return 0;
         });
 
@@ -181,6 +183,7 @@ namespace whilelang {
                 },
             }};
         gather_flow_graph.post([=](Node) {
+            cfg->freeze();
             cfg->set_dirty_flag(false);
             return 0;
         });
@@ -1,8 +1,208 @@
+#include <numeric>
+
+#include "../analyses/dense_state.hh"
 #include "../internal.hh"
 namespace whilelang {
 
     using namespace trieste;
 
+    namespace {
+        // Merges declared variables whose live ranges do not overlap, so
+        // fewer locals are declared. Variables joined by a copy are merged
+        // first, which turns the copy into a self assignment. Returns the
+        // new name of every renamed variable
+        std::map<std::string, std::string>
+        coalesce(const Node &body, const std::vector<std::string> &declared) {
+            std::map<std::string, std::string> renames;
+            std::map<std::string, size_t> var_index;
+            std::map<std::string, size_t> label_index;
+            Nodes stmts;
+
+            for (size_t v = 0; v < declared.size(); v++) {
+                var_index.insert({declared[v], v});
+            }
+
+            for (const auto &child : *body) {
+                auto stmt = child / Stmt;
+
+                if (stmt == Block) {
+                    // Only flat bodies are analysed
+                    return renames;
+                } else if (stmt == Label) {
+                    label_index.insert(
+                        {std::string(stmt->location().view()), stmts.size()});
+                }
+                stmts.push_back(stmt);
+            }
+
+            const size_t n = stmts.size();
+            const size_t k = declared.size();
+
+            auto index_of = [&](const Node &ident) -> std::optional<size_t> {
+                auto res =
+                    var_index.find(std::string(ident->location().view()));
+                if (res == var_index.end()) {
+                    return std::nullopt;
+                }
+                return res->second;
+            };
+
+            auto label_of = [&](const Node &label) {
+                return label_index.at(std::string(label->location().view()));
+            };
+
+            std::vector<std::vector<size_t>> succs(n);
+            std::vector<BitVector> uses(n, BitVector(k));
+            std::vector<std::optional<size_t>> defs(n);
+            std::vector<std::optional<size_t>> copy_of(n);
+
+            for (size_t i = 0; i < n; i++) {
+                const Node &stmt = stmts[i];
+
+                if (stmt == Jump) {
+                    succs[i].push_back(label_of(stmt / Label));
+                } else if (stmt == Cond) {
+                    succs[i].push_back(label_of(stmt / Then));
+                    succs[i].push_back(label_of(stmt / Else));
+                } else if (stmt != Return && i + 1 < n) {
+                    succs[i].push_back(i + 1);
+                }
+
+                if (stmt == Var) {
+                    continue;
+                }
+
+                Node lhs = stmt == Assign ? stmt / Ident : Node{};
+                stmt->traverse([&](Node curr) {
+                    if (curr == Ident && curr != lhs) {
+                        if (auto v = index_of(curr)) {
+                            uses[i].insert(*v);
+                        }
+                    }
+                    return true;
+                });
+
+                if (stmt == Assign) {
+                    defs[i] = index_of(lhs);
+
+                    auto expr = (stmt / Rhs) / Expr;
+                    if (expr->type().in({Atom, BAtom}) &&
+                        expr / Expr == Ident) {
+                        copy_of[i] = index_of(expr / Expr);
+                    }
+                }
+            }
+
+            // Live variables before every statement
+            std::vector<BitVector> live_in(n, BitVector(k));
+            bool changed = true;
+
+            while (changed) {
+                changed = false;
+
+                for (size_t i = n; i-- > 0;) {
+                    BitVector live(k);
+                    for (size_t succ : succs[i]) {
+                        live.join(live_in[succ]);
+                    }
+                    if (defs[i]) {
+                        live.erase(*defs[i]);
+                    }
+                    live.join(uses[i]);
+
+                    if (!(live == live_in[i])) {
+                        live_in[i] = std::move(live);
+                        changed = true;
+                    }
+                }
+            }
+
+            std::vector<BitVector> interferes(k, BitVector(k));
+            auto add_interference = [&](size_t a, size_t b) {
+                if (a != b) {
+                    interferes[a].insert(b);
+                    interferes[b].insert(a);
+                }
+            };
+
+            // Variables read before any assignment hold unknown values
+            if (n > 0) {
+                live_in[0].for_each([&](size_t a) {
+                    live_in[0].for_each(
+                        [&](size_t b) { add_interference(a, b); });
+                });
+            }
+
+            for (size_t i = 0; i < n; i++) {
+                if (!defs[i]) {
+                    continue;
+                }
+
+                BitVector live_out(k);
+                for (size_t succ : succs[i]) {
+                    live_out.join(live_in[succ]);
+                }
+
+                live_out.for_each([&](size_t b) {
+                    if (copy_of[i] != b) {
+                        add_interference(*defs[i], b);
+                    }
+                });
+            }
+
+            // Classes of merged variables, with the union of the
+            // interferences of their members
+            std::vector<size_t> class_of(k);
+            std::vector<BitVector> class_interferes = interferes;
+            std::iota(class_of.begin(), class_of.end(), 0);
+
+            auto find = [&](size_t v) {
+                while (class_of[v] != v) {
+                    v = class_of[v];
+                }
+                return v;
+            };
+
+            auto merge = [&](size_t a, size_t b) {
+                a = find(a);
+                b = find(b);
+
+                if (a == b || class_interferes[a].contains(b)) {
+                    return;
+                }
+
+                class_of[b] = a;
+                class_interferes[a].join(class_interferes[b]);
+                for (size_t v = 0; v < k; v++) {
+                    if (class_interferes[v].contains(b)) {
+                        class_interferes[v].insert(a);
+                    }
+                }
+            };
+
+            for (size_t i = 0; i < n; i++) {
+                if (defs[i] && copy_of[i]) {
+                    merge(*copy_of[i], *defs[i]);
+                }
+            }
+
+            for (size_t v = 0; v < k; v++) {
+                for (size_t c = 0; c < v; c++) {
+                    if (find(c) == c && find(v) == v) {
+                        merge(c, v);
+                    }
+                }
+            }
+
+            for (size_t v = 0; v < k; v++) {
+                if (find(v) != v) {
+                    renames.insert({declared[v], declared[find(v)]});
+                }
+            }
+            return renames;
+        }
+    }
+
     PassDef gather_vars() {
         return {
             "gather_vars",
@@ -20,11 +220,64 @@ namespace whilelang {
                             return n == Var;
                         });
 
+                        std::vector<std::string> declared;
+                        for (const auto &var : vars) {
+                            declared.push_back(
+                                std::string((var / Ident)->location().view()));
+                        }
+
+                        auto renames = coalesce(body / Stmt, declared);
+
                         Node idents = Idents;
                         for (const auto &var : vars) {
-                            idents << (var / Ident);
+                            if (!renames.contains(std::string(
+                                    (var / Ident)->location().view()))) {
+                                idents << (var / Ident);
+                            }
+                        }
+
+                        Nodes renamed;
+                        body->traverse([&](Node curr) {
+                            if (curr == Ident &&
+                                renames.contains(
+                                    std::string(curr->location().view()))) {
+                                renamed.push_back(curr);
+                            }
+                            return true;
+                        });
+
+                        for (const auto &ident : renamed) {
+                            auto name = std::string(ident->location().view());
+                            ident->parent()->replace(
+                                ident, Ident ^ renames.at(name));
                         }
 
+                        // Copies between merged variables are no-ops
+                        Nodes self_copies;
+                        for (const auto &stmt : *(body / Stmt)) {
+                            auto assign = stmt / Stmt;
+                            if (assign != Assign) {
+                                continue;
+                            }
+
+                            auto expr = (assign / Rhs) / Expr;
+                            if (expr->type().in({Atom, BAtom}) &&
+                                expr / Expr == Ident &&
+                                (expr / Expr)->location().view() ==
+                                    (assign / Ident)->location().view()) {
+                                self_copies.push_back(stmt);
+                            }
+                        }
+
+                        for (const auto &stmt : self_copies) {
+                            (body / Stmt)->replace(stmt, Stmt << Skip);
+                        }
+
+                        logging::Debug()
+                            << "Coalesced " << renames.size() << " of "
+                            << declared.size() << " locals in "
+                            << fun_id->location().view();
+
                         return FunDef << fun_id << param_list << idents << body;
                     },
 
@@ -0,0 +1,186 @@
+#include "../internal.hh"
+#include "../ssa.hh"
+#include "../utils.hh"
+
+namespace whilelang {
+    using namespace trieste;
+
+    namespace {
+        // Operands are SSA values or constants, constants are tagged with
+        // the top bit so they never collide with a value
+        constexpr uint64_t constant_tag = uint64_t(1) << 63;
+        constexpr uint64_t no_operand = UINT64_MAX;
+
+        struct Expression {
+            uint8_t op;
+            uint64_t lhs;
+            uint64_t rhs;
+
+            bool operator==(const Expression &other) const = default;
+        };
+
+        struct ExpressionHash {
+            size_t operator()(const Expression &e) const {
+                size_t h = std::hash<uint64_t>()(e.lhs);
+                h ^= std::hash<uint64_t>()(e.rhs) + 0x9e3779b9 + (h << 6) +
+                    (h >> 2);
+                return h ^ e.op;
+            }
+        };
+
+        uint8_t op_code(const Node &op) {
+            if (op == Add) {
+                return 1;
+            } else if (op == Sub) {
+                return 2;
+            } else if (op == Mul) {
+                return 3;
+            } else if (op == LT) {
+                return 4;
+            } else if (op == Equals) {
+                return 5;
+            } else if (op == And) {
+                return 6;
+            } else if (op == Or) {
+                return 7;
+            }
+            return 0;
+        }
+
+        uint64_t operand(
+            uint32_t inst,
+            const Node &atom,
+            const SSA &ssa,
+            const std::shared_ptr<ControlFlow> &cfg) {
+            Node expr = atom / Expr;
+
+            if (expr == Int) {
+                return constant_tag | uint32_t(get_int_value(expr));
+            } else if (expr == True || expr == False) {
+                return constant_tag | (expr == True ? 1 : 0);
+            } else if (expr == Ident) {
+                SSA::Value value = ssa.use(inst, cfg->get_var_id(expr));
+                return value == SSA::undefined ? no_operand : value;
+            }
+            return no_operand;
+        }
+    }
+
+    PassDef global_value_numbering(std::shared_ptr<ControlFlow> cfg) {
+        // Assignments whose computation is replaced by a copy of the
+        // variable holding the same value
+        auto copies = std::make_shared<NodeMap<Node>>();
+
+        PassDef gvn = {
+            "global_value_numbering",
+            normalization_wf,
+            dir::bottomup | dir::once,
+            {
+                In(AExpr, BExpr) *
+                        T(Add, Sub, Mul, LT, Equals, And, Or)[Op] >>
+                    [=](Match &_) -> Node {
+                    auto assign = _(Op)->parent(Assign);
+                    auto res = copies->find(assign);
+
+                    if (res == copies->end()) {
+                        return NoChange;
+                    }
+
+                    cfg->record_changed(assign);
+                    if (_(Op)->parent() == AExpr) {
+                        return Atom << res->second->clone();
+                    }
+                    return BAtom << res->second->clone();
+                },
+            }};
+
+        // Walks the dominator tree of every function with a scoped table
+        // of the expressions computed so far. An expression computed again
+        // is replaced by a copy when the variable holding the first result
+        // still holds it, which the reaching definitions tell
+        gvn.pre([=](Node) {
+            copies->clear();
+
+            SSA ssa(cfg);
+            std::unordered_map<Expression, SSA::Value, ExpressionHash> table;
+
+            // Entries added or shadowed at every instruction on the path
+            // from the root, restored when the walk leaves it
+            using Scope =
+                std::vector<std::pair<Expression, std::optional<SSA::Value>>>;
+            std::vector<Scope> scopes;
+
+            auto enter = [&](uint32_t i, const auto &reaching) {
+                const Node &inst = cfg->get_instruction(i);
+                Scope &scope = scopes.emplace_back();
+
+                Node expr = inst == Assign ? (inst / Rhs) / Expr : Node{};
+                uint8_t op = expr ? op_code(expr) : 0;
+
+                if (op == 0) {
+                    return;
+                }
+
+                SSA::Value own = ssa.defined_at(i).back();
+                Expression key = {
+                    op,
+                    operand(i, expr / Lhs, ssa, cfg),
+                    operand(i, expr / Rhs, ssa, cfg)};
+
+                if (expr->type().in({Add, Mul, Equals, And, Or}) &&
+                    key.rhs < key.lhs) {
+                    std::swap(key.lhs, key.rhs);
+                }
+
+                if (key.lhs == no_operand || key.rhs == no_operand) {
+                    return;
+                }
+
+                auto res = table.find(key);
+                if (res == table.end()) {
+                    scope.push_back({key, std::nullopt});
+                    table.insert({key, own});
+                    return;
+                }
+
+                const auto &first = ssa.definition(res->second);
+
+                if (first.var == ssa.definition(own).var) {
+                    // Copying the variable to itself gains nothing
+                } else if (reaching(first.var) == res->second) {
+                    copies->insert(
+                        {inst, cfg->get_instruction(first.inst) / Ident});
+                } else {
+                    // The first result was overwritten, this computation
+                    // becomes the one to reuse
+                    scope.push_back({key, res->second});
+                    res->second = own;
+                }
+            };
+
+            auto leave = [&](uint32_t) {
+                Scope &scope = scopes.back();
+
+                for (auto it = scope.rbegin(); it != scope.rend(); it++) {
+                    if (it->second) {
+                        table[it->first] = *it->second;
+                    } else {
+                        table.erase(it->first);
+                    }
+                }
+                scopes.pop_back();
+            };
+
+            ssa.walk(cfg, enter, leave);
+            return 0;
+        });
+
+        gvn.post([=](Node) {
+            logging::Info() << "Global value numbering eliminated "
+                            << copies->size() << " expressions";
+            return 0;
+        });
+
+        return gvn;
+    }
+}
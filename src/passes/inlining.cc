@@ -5,7 +5,11 @@ namespace whilelang {
     using namespace trieste;
 
     // Creates assignments for the parameters of the function call
-    Node assign_params(Match &_, std::map<Location, Location> &fresh_vars, Node &params, Node &args) {
+    Node assign_params(
+        Node ast,
+        std::map<Location, Location> &fresh_vars,
+        Node &params,
+        Node &args) {
         Node builder = Stmt;
         auto param_it = params->begin();
         auto arg_it = args->begin();
@@ -14,7 +18,7 @@ namespace whilelang {
             auto atom = *arg_it / Atom;
             auto ident = *param_it / Ident;
 
-            fresh_vars[ident->location()] = _.fresh();
+            fresh_vars[ident->location()] = ast->fresh();
             auto new_ident = Ident ^ fresh_vars[ident->location()];
 
             builder
@@ -29,75 +33,181 @@ namespace whilelang {
         return builder;
     }
 
+    namespace {
+        // Adds delta to the call count of every function called in node
+        void count_calls(
+            const Node &node, std::map<Vertex, int> &calls, int delta = 1) {
+            node->traverse([&](Node curr) {
+                if (curr == FunCall) {
+                    calls[get_identifier(curr / FunId)] += delta;
+                }
+                return true;
+            });
+        }
+
+        // The statements replacing the call statement x = f(args): the
+        // parameters are assigned the arguments, followed by the body of f
+        // with fresh variables and its returns assigning x
+        Node inline_call(Node ast, const Node &stmt, const Node &fun_def) {
+            auto assign = stmt / Stmt;
+            auto fun_call = (assign / Rhs) / Expr;
+
+            auto fresh_vars = std::map<Location, Location>();
+            auto params = fun_def / ParamList;
+            auto args = fun_call / ArgList;
+            auto arg_assignments =
+                assign_params(ast, fresh_vars, params, args);
+
+            // Ensure inlined function has unique variables and uses
+            // fresh parameter names
+            auto fun_body = ((fun_def / Body) / Stmt)->clone();
+            fun_body->traverse([&](Node node) {
+                if (node != Ident)
+                    return true;
+
+                auto loc = node->location();
+
+                if (fresh_vars.find(loc) == fresh_vars.end()) {
+                    fresh_vars[loc] = ast->fresh();
+                }
+                Node new_ident = Ident ^ fresh_vars[loc];
+                node->parent()->replace(node, new_ident);
+
+                return true;
+            });
+
+            // Replace all return statements with assignments
+            Node ret_var = Ident ^ ast->fresh();
+            fun_body->traverse([&](Node node) {
+                if (node != Return)
+                    return true;
+
+                Node assign = Assign << ret_var->clone()
+                                     << (AExpr << *node);
+
+                node->parent()->replace(node, assign);
+
+                return false;
+            });
+
+            // Replace the previous fun call with assignment
+            // to return ident
+            Node ret_assignment = Stmt
+                << (Assign << (assign / Ident)->clone()
+                           << (AExpr << (Atom << ret_var->clone())));
+
+            return Stmt
+                << (Block << *arg_assignments << *fun_body
+                          << ret_assignment);
+        }
+    }
+
+    // Functions are visited callees first, in reverse topological order of
+    // the strongly connected components of the call graph. A callee is then
+    // complete before it is cloned into its callers, so every function is
+    // inlined into only once and the clones are never matched again.
+    //
+    // Every call that the call graph allows to be inlined is weighed by the
+    // cost model of inline_cost, and is inlined when its cost is within
+    // inline_limit of the threshold. A function whose last call site is
+    // inlined is removed, so that call moves its body rather than copying
+    // it and does not count against the budget. All inlining together may
+    // grow the program by at most budget percent of its size
     PassDef inlining(
         std::shared_ptr<CallGraph> call_graph,
-        std::shared_ptr<ControlFlow> cfg) {
+        std::shared_ptr<ControlFlow> cfg,
+        size_t threshold,
+        size_t budget) {
         PassDef pass = {
-            "inlining",
-            normalization_wf,
-            dir::topdown,
-            {
-                T(Stmt)
-                        << (T(Assign) << T(Ident)[Ident] *
-                                (T(AExpr) << T(FunCall)[FunCall])) >>
-                    [=](Match &_) -> Node {
-                    auto fun_call = _(FunCall);
-                    auto fun_id = get_identifier(fun_call / FunId);
-
-                    if (!call_graph->can_be_inlined(fun_id)) {
-                        return NoChange;
+            "inlining", normalization_wf, dir::topdown | dir::once, {}};
+
+        pass.pre([=](Node ast) {
+            std::map<Vertex, Node> fun_defs;
+            size_t program_size = 0;
+
+            for (const auto &fun_def : *ast->front()) {
+                fun_defs.insert({get_identifier(fun_def / FunId), fun_def});
+                program_size += body_size(fun_def);
+            }
+
+            size_t growth_left = program_size * budget / 100;
+            std::map<Vertex, int> calls;
+            count_calls(ast, calls);
+
+            size_t inlined = 0;
+
+            for (auto scc = call_graph->SCCs.rbegin();
+                 scc != call_graph->SCCs.rend();
+                 scc++) {
+                for (const Vertex &caller : scc->nodes) {
+                    auto caller_def = fun_defs.find(caller);
+                    if (caller_def == fun_defs.end()) {
+                        continue;
                     }
 
-                    cfg->set_dirty_flag(true);
-
-                    auto fun_def = cfg->get_fun_def(fun_call);
-
-                    auto fresh_vars = std::map<Location, Location>();
-                    auto arg_assignments =
-                        assign_params(_, fresh_vars, fun_def / ParamList, fun_call / ArgList);
-
-                    // Ensure inlined function has unique variables and uses
-                    // fresh parameter names
-                    auto fun_body = ((fun_def / Body) / Stmt)->clone();
-                    fun_body->traverse([&](Node node) {
-                        if (node != Ident)
-                            return true;
+                    Nodes call_stmts;
+                    caller_def->second->traverse([&](Node node) {
+                        if (node == Stmt && node / Stmt == Assign &&
+                            ((node / Stmt) / Rhs) / Expr == FunCall) {
+                            call_stmts.push_back(node);
+                        }
+                        return true;
+                    });
 
-                        auto loc = node->location();
+                    for (const auto &stmt : call_stmts) {
+                        auto fun_call = ((stmt / Stmt) / Rhs) / Expr;
+                        auto fun_id = get_identifier(fun_call / FunId);
 
-                        if (fresh_vars.find(loc) == fresh_vars.end()) {
-                            fresh_vars[loc] = _.fresh();
+                        if (!call_graph->can_be_inlined(fun_id) ||
+                            !fun_defs.contains(fun_id)) {
+                            continue;
                         }
-                        Node new_ident = Ident ^ fresh_vars[loc];
-                        node->parent()->replace(node, new_ident);
 
-                        return true;
-                    });
+                        auto fun_def = fun_defs.at(fun_id);
+                        size_t size = body_size(fun_def);
+                        bool last_call =
+                            calls[fun_id] <= 1 && fun_id != "main";
+                        size_t cost =
+                            inline_cost(fun_call, fun_def, calls[fun_id]);
+                        size_t limit = inline_limit(fun_call, threshold);
+
+                        if (cost > limit ||
+                            (!last_call && size > growth_left)) {
+                            logging::Debug()
+                                << "Not inlining " << fun_id << " of size "
+                                << size << " and cost " << cost;
+                            continue;
+                        }
 
-                    // Replace all return statements with assignments
-                    Node ret_var = Ident ^ _.fresh();
-                    fun_body->traverse([&](Node node) {
-                        if (node != Return)
-                            return true;
+                        if (!last_call) {
+                            growth_left -= size;
+                        }
 
-                        Node assign = Assign << ret_var->clone()
-                                             << (AExpr << *node);
+                        auto inlined_stmt = inline_call(ast, stmt, fun_def);
+                        calls[fun_id]--;
+                        count_calls(inlined_stmt, calls);
 
-                        node->parent()->replace(node, assign);
+                        stmt->parent()->replace(stmt, inlined_stmt);
+                        inlined++;
 
-                        return false;
-                    });
+                        if (last_call) {
+                            count_calls(fun_def, calls, -1);
+                            fun_defs.erase(fun_id);
+                            ast->front()->replace(fun_def);
+                            logging::Debug() << "Removed " << fun_id
+                                             << " after inlining its last call";
+                        }
+                    }
+                }
+            }
 
-                    // Replace the previous fun call with assignment
-                    // to return ident
-                    Node ret_assignment = Stmt
-                        << (Assign << _(Ident)
-                                   << (AExpr << (Atom << ret_var->clone())));
+            if (inlined > 0) {
+                cfg->set_dirty_flag(true);
+            }
 
-                    return Seq << *arg_assignments << *fun_body
-                               << ret_assignment;
-                },
-            }};
+            logging::Debug() << "Inlined " << inlined << " calls";
+            return inlined;
+        });
 
         return pass;
     }
@@ -0,0 +1,80 @@
+#include "../analyses/dataflow_analysis.hh"
+#include "../analyses/interval.hh"
+#include "../internal.hh"
+#include "../utils.hh"
+
+namespace whilelang {
+    using namespace trieste;
+
+    PassDef interval_analysis(std::shared_ptr<ControlFlow> cfg) {
+        auto analysis = std::make_shared<
+            DataFlowAnalysis<IntervalState, Interval, IntervalImpl>>();
+
+        auto range_of = [=](const Node &atom, const Node &inst) {
+            return get_interval_from_atom(
+                atom, analysis->get_state(inst), cfg);
+        };
+
+        PassDef interval_analysis = {
+            "interval_analysis",
+            normalization_wf,
+            dir::bottomup | dir::once,
+            {
+                // Comparisons decided by the ranges of their operands become
+                // constants, the branches reading them are then decided by
+                // constant folding and dead code elimination
+                In(BExpr) * T(LT, Equals)[Op] >> [=](Match &_) -> Node {
+                    auto op = _(Op);
+                    auto inst = op->parent(Assign);
+                    auto res = apply_interval_test(
+                        op, range_of(op / Lhs, inst), range_of(op / Rhs, inst));
+
+                    if (res.is_bottom() || !res.is_constant()) {
+                        return NoChange;
+                    }
+
+                    cfg->record_changed(inst);
+                    return BAtom << (res.lo == 1 ? True : False);
+                },
+            }};
+
+        interval_analysis.pre([=](Node) {
+            auto first_state =
+                IntervalState(cfg->get_vars().size(), Interval::top());
+
+            analysis->forward_worklist_algoritm(cfg, first_state);
+
+            cfg->log_instructions();
+            analysis->log_state_table(cfg);
+
+            // The VIR backend computes in 32 bits, an operation whose every
+            // result lies outside of that range always overflows
+            for (const auto &inst : cfg->get_instructions()) {
+                if (inst != Assign) {
+                    continue;
+                }
+
+                Node expr = (inst / Rhs) / Expr;
+                if (!expr->type().in({Add, Mul})) {
+                    continue;
+                }
+
+                auto range = apply_interval_op(
+                    expr,
+                    range_of(expr / Lhs, inst),
+                    range_of(expr / Rhs, inst));
+
+                if (range.overflows()) {
+                    logging::Warn()
+                        << "Assignment to " << (inst / Ident)->location().view()
+                        << " always overflows int32, its exact value lies in "
+                        << range;
+                }
+            }
+
+            return 0;
+        });
+
+        return interval_analysis;
+    }
+}
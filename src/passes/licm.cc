@@ -0,0 +1,172 @@
+#include "../analyses/dataflow_analysis.hh"
+#include "../analyses/liveness.hh"
+#include "../internal.hh"
+#include "../utils.hh"
+
+namespace whilelang {
+    using namespace trieste;
+
+    namespace {
+        // Adds the variables read by the node to operands, returns whether
+        // the node reads input
+        bool collect_operands(
+            const Node &node,
+            LiveState &operands,
+            const std::shared_ptr<ControlFlow> &cfg) {
+            bool reads_input = false;
+
+            node->traverse([&](Node curr) {
+                if (curr == Input) {
+                    reads_input = true;
+                } else if (
+                    curr == Ident && curr->parent()->in({Atom, BAtom})) {
+                    operands.insert(cfg->get_var_id(curr));
+                }
+                return true;
+            });
+            return reads_input;
+        }
+    }
+
+    PassDef loop_invariant_code_motion(
+        std::shared_ptr<ControlFlow> cfg, size_t threads) {
+        auto analysis = std::make_shared<
+            DataFlowAnalysis<LiveState, std::string, LiveImpl>>();
+        analysis->set_threads(threads);
+
+        // Assignments to move in front of every While, in program order
+        auto hoists = std::make_shared<NodeMap<Nodes>>();
+
+        PassDef licm = {
+            "loop_invariant_code_motion",
+            normalization_wf,
+            dir::bottomup | dir::once,
+            {
+                T(Stmt)[Stmt] << T(While)[While] >> [=](Match &_) -> Node {
+                    auto res = hoists->find(_(While));
+
+                    if (res == hoists->end()) {
+                        return NoChange;
+                    }
+
+                    // The assignment moves in front of the loop and leaves
+                    // a skip behind, which dead code elimination removes
+                    Nodes preheader;
+                    for (const auto &assign : res->second) {
+                        auto stmt = assign->parent();
+                        stmt->parent()->replace(stmt, Stmt << Skip);
+                        preheader.push_back(stmt);
+                    }
+
+                    cfg->set_dirty_flag(true);
+                    return Stmt << (Block << preheader << _(Stmt));
+                },
+            }};
+
+        // An assignment x = e in loop L is hoisted when e reads neither
+        // input nor a variable assigned in L, x is assigned only once in L
+        // and x is not live on entry to L. The loop may run zero times, so
+        // the last condition also rules out x being read after the loop
+        // without being assigned in it. Calls can not change the variables
+        // of the caller, but their results are never hoisted
+        licm.pre([=](Node ast) {
+            hoists->clear();
+
+            LiveState first_state = LiveState(cfg->get_vars().size());
+            analysis->backward_worklist_algoritm(cfg, first_state);
+
+            const LoopForest &forest = cfg->get_loop_forest();
+            std::vector<Node> loop_while(forest.loops.size());
+            std::unordered_map<uint32_t, uint32_t> loop_of_header;
+
+            for (uint32_t l = 0; l < forest.loops.size(); l++) {
+                loop_of_header.insert({forest.loops[l].header, l});
+            }
+
+            ast->traverse([&](Node curr) {
+                if (curr == While) {
+                    auto header =
+                        cfg->get_index(get_first_basic_child(curr / Stmt));
+                    auto res = loop_of_header.find(header);
+
+                    if (res != loop_of_header.end()) {
+                        loop_while[res->second] = curr;
+                    }
+                }
+                return true;
+            });
+
+            const size_t vars = cfg->get_vars().size();
+
+            for (uint32_t l = 0; l < forest.loops.size(); l++) {
+                const Loop &loop = forest.loops[l];
+
+                if (!loop_while[l]) {
+                    continue;
+                }
+
+                std::vector<uint32_t> assigned(vars, 0);
+                for (uint32_t i : loop.body) {
+                    const Node &inst = cfg->get_instruction(i);
+
+                    // Declared variables that are never used are not known
+                    // to the control flow graph
+                    if (inst == Assign ||
+                        (inst == Var &&
+                         cfg->get_vars().contains(inst / Ident))) {
+                        assigned[cfg->get_var_id(inst / Ident)]++;
+                    }
+                }
+
+                const Node &header = cfg->get_instruction(loop.header);
+                LiveState header_reads(vars);
+                collect_operands(header, header_reads, cfg);
+
+                auto live_on_entry = [&](VarId var) {
+                    if (header_reads.contains(var)) {
+                        return true;
+                    } else if (
+                        header == Assign &&
+                        cfg->get_var_id(header / Ident) == var) {
+                        return false;
+                    }
+                    return analysis->get_state(header).contains(var);
+                };
+
+                for (uint32_t i : loop.body) {
+                    const Node &inst = cfg->get_instruction(i);
+
+                    if (forest.loop_of[i] != l || inst != Assign ||
+                        (inst / Rhs) / Expr == FunCall) {
+                        continue;
+                    }
+
+                    VarId var = cfg->get_var_id(inst / Ident);
+                    if (assigned[var] != 1 || live_on_entry(var)) {
+                        continue;
+                    }
+
+                    LiveState operands(vars);
+                    if (collect_operands(inst / Rhs, operands, cfg)) {
+                        continue;
+                    }
+
+                    bool invariant = true;
+                    operands.for_each([&](size_t operand) {
+                        invariant &= assigned[operand] == 0;
+                    });
+
+                    if (invariant) {
+                        (*hoists)[loop_while[l]].push_back(inst);
+                    }
+                }
+            }
+
+            logging::Debug() << "Hoisting out of " << hoists->size()
+                             << " loops";
+            return 0;
+        });
+
+        return licm;
+    }
+}
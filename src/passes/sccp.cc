@@ -0,0 +1,52 @@
+#include "../analyses/sccp.hh"
+#include "../internal.hh"
+#include "../utils.hh"
+
+namespace whilelang {
+    using namespace trieste;
+
+    PassDef sccp(std::shared_ptr<ControlFlow> cfg) {
+        auto analysis = std::make_shared<SCCP>();
+
+        PassDef sccp = {
+            "sccp",
+            normalization_wf,
+            dir::bottomup | dir::once,
+            {
+                In(Atom) * T(Ident)[Ident] >> [=](Match &_) -> Node {
+                    auto inst = fetch_instruction(_(Ident));
+                    auto var = cfg->get_var_id(_(Ident));
+                    auto lattice_value = analysis->value_at(inst, var);
+
+                    if (lattice_value.type == CPAbstractType::Constant) {
+                        cfg->record_changed(inst);
+                        return create_const_node(*lattice_value.value);
+                    } else {
+                        return NoChange;
+                    }
+                },
+
+                In(BAtom) * T(Ident)[Ident] >> [=](Match &_) -> Node {
+                    auto inst = fetch_instruction(_(Ident));
+                    auto var = cfg->get_var_id(_(Ident));
+                    auto lattice_value = analysis->value_at(inst, var);
+
+                    if (lattice_value.type == CPAbstractType::Constant) {
+                        cfg->record_changed(inst);
+                        return *lattice_value.value ? True : False;
+                    } else {
+                        return NoChange;
+                    }
+                },
+            }};
+
+        sccp.pre([=](Node) {
+            analysis->run(cfg);
+            analysis->log(cfg);
+
+            return 0;
+        });
+
+        return sccp;
+    }
+}
@@ -0,0 +1,297 @@
+#include "../internal.hh"
+#include "../utils.hh"
+
+namespace whilelang {
+    using namespace trieste;
+
+    namespace {
+        std::optional<int> get_atom_int(const Node &atom) {
+            if (atom / Expr == Int) {
+                return get_int_value(atom / Expr);
+            }
+            return std::nullopt;
+        }
+
+        std::optional<bool> get_atom_bool(const Node &atom) {
+            if ((atom / Expr)->type().in({True, False})) {
+                return atom / Expr == True;
+            }
+            return std::nullopt;
+        }
+
+        bool same_variable(const Node &lhs, const Node &rhs) {
+            return lhs / Expr == Ident && rhs / Expr == Ident &&
+                (lhs / Expr)->location().view() ==
+                (rhs / Expr)->location().view();
+        }
+
+        // Wrapping int32 arithmetic, as the compiled program does
+        int wrapping_mul(int x, int y) {
+            return static_cast<int>(
+                static_cast<uint32_t>(x) * static_cast<uint32_t>(y));
+        }
+    }
+
+    PassDef algebraic_simplification(std::shared_ptr<ControlFlow> cfg) {
+        PassDef algebraic_simplification = {
+            "algebraic_simplification",
+            normalization_wf,
+            dir::bottomup | dir::once,
+            {
+                In(AExpr) * T(Add, Sub, Mul)[Op] >> [=](Match &_) -> Node {
+                    auto op = _(Op);
+                    auto inst = op->parent(Assign);
+                    auto lhs = op / Lhs;
+                    auto rhs = op / Rhs;
+                    auto lhs_int = get_atom_int(lhs);
+                    auto rhs_int = get_atom_int(rhs);
+                    Node res;
+
+                    if (op == Add && lhs_int == 0) {
+                        res = Atom << (rhs / Expr)->clone();
+                    } else if (op->type().in({Add, Sub}) && rhs_int == 0) {
+                        res = Atom << (lhs / Expr)->clone();
+                    } else if (op == Sub && same_variable(lhs, rhs)) {
+                        res = Atom << create_const_node(0);
+                    } else if (
+                        op == Mul && (lhs_int == 0 || rhs_int == 0) &&
+                        lhs / Expr != Input && rhs / Expr != Input) {
+                        // Reads of input are kept for their side effect
+                        res = Atom << create_const_node(0);
+                    } else if (op == Mul && lhs_int == 1) {
+                        res = Atom << (rhs / Expr)->clone();
+                    } else if (op == Mul && rhs_int == 1) {
+                        res = Atom << (lhs / Expr)->clone();
+                    } else if (op == Mul && (lhs_int == 2 || rhs_int == 2)) {
+                        // Doubling is an addition
+                        auto other = lhs_int == 2 ? rhs : lhs;
+                        if (other / Expr == Input) {
+                            return NoChange;
+                        }
+                        res = Add << other->clone() << other->clone();
+                    } else {
+                        return NoChange;
+                    }
+
+                    cfg->record_changed(inst);
+                    return res;
+                },
+
+                In(BExpr) * T(And, Or, LT, Equals)[Op] >>
+                    [=](Match &_) -> Node {
+                    auto op = _(Op);
+                    auto lhs = op / Lhs;
+                    auto rhs = op / Rhs;
+                    Node res;
+
+                    if (op->type().in({And, Or})) {
+                        // The value that decides the operation on its own
+                        bool absorbing = op == Or;
+                        auto lhs_bool = get_atom_bool(lhs);
+                        auto rhs_bool = get_atom_bool(rhs);
+
+                        if (lhs_bool == absorbing || rhs_bool == absorbing) {
+                            res = BAtom << (absorbing ? True : False);
+                        } else if (lhs_bool || same_variable(lhs, rhs)) {
+                            res = BAtom << (rhs / Expr)->clone();
+                        } else if (rhs_bool) {
+                            res = BAtom << (lhs / Expr)->clone();
+                        }
+                    } else if (same_variable(lhs, rhs)) {
+                        res = BAtom << (op == Equals ? True : False);
+                    }
+
+                    if (!res) {
+                        return NoChange;
+                    }
+
+                    cfg->record_changed(op->parent(Assign));
+                    return res;
+                },
+            }};
+
+        return algebraic_simplification;
+    }
+
+    PassDef strength_reduction(std::shared_ptr<ControlFlow> cfg) {
+        // Statements to place in front of every While, after every
+        // induction variable update, and the variable replacing every
+        // reduced multiplication
+        auto preheaders = std::make_shared<NodeMap<Nodes>>();
+        auto updates = std::make_shared<NodeMap<Nodes>>();
+        auto reduced = std::make_shared<NodeMap<Node>>();
+
+        PassDef strength_reduction = {
+            "strength_reduction",
+            normalization_wf,
+            dir::bottomup | dir::once,
+            {
+                In(AExpr) * T(Mul)[Mul] >> [=](Match &_) -> Node {
+                    auto res = reduced->find(_(Mul)->parent(Assign));
+
+                    if (res == reduced->end()) {
+                        return NoChange;
+                    }
+                    return Atom << res->second->clone();
+                },
+
+                T(Stmt)[Stmt] << T(Assign)[Assign] >> [=](Match &_) -> Node {
+                    auto res = updates->find(_(Assign));
+
+                    if (res == updates->end()) {
+                        return NoChange;
+                    }
+                    return Stmt << (Block << _(Stmt) << res->second);
+                },
+
+                T(Stmt)[Stmt] << T(While)[While] >> [=](Match &_) -> Node {
+                    auto res = preheaders->find(_(While));
+
+                    if (res == preheaders->end()) {
+                        return NoChange;
+                    }
+
+                    cfg->set_dirty_flag(true);
+                    return Stmt << (Block << res->second << _(Stmt));
+                },
+            }};
+
+        // A basic induction variable i is assigned exactly once in a loop,
+        // by i = i + c or i = i - c with a constant c. Every t = i * k with
+        // a constant k in the loop then reads a new variable s instead,
+        // which is set to i * k in front of the loop and moved by c * k
+        // right after every update of i. Multiplications that the
+        // algebraic simplification handles are left to it
+        strength_reduction.pre([=](Node ast) {
+            preheaders->clear();
+            updates->clear();
+            reduced->clear();
+
+            const LoopForest &forest = cfg->get_loop_forest();
+            std::vector<Node> loop_while(forest.loops.size());
+            std::unordered_map<uint32_t, uint32_t> loop_of_header;
+
+            for (uint32_t l = 0; l < forest.loops.size(); l++) {
+                loop_of_header.insert({forest.loops[l].header, l});
+            }
+
+            ast->traverse([&](Node curr) {
+                if (curr == While) {
+                    auto header =
+                        cfg->get_index(get_first_basic_child(curr / Stmt));
+                    auto res = loop_of_header.find(header);
+
+                    if (res != loop_of_header.end()) {
+                        loop_while[res->second] = curr;
+                    }
+                }
+                return true;
+            });
+
+            const size_t vars = cfg->get_vars().size();
+
+            for (uint32_t l = 0; l < forest.loops.size(); l++) {
+                const Loop &loop = forest.loops[l];
+
+                if (!loop_while[l]) {
+                    continue;
+                }
+
+                std::vector<uint32_t> assigned(vars, 0);
+                std::vector<Node> update_of(vars);
+
+                for (uint32_t i : loop.body) {
+                    const Node &inst = cfg->get_instruction(i);
+
+                    if (inst == Assign ||
+                        (inst == Var &&
+                         cfg->get_vars().contains(inst / Ident))) {
+                        VarId var = cfg->get_var_id(inst / Ident);
+                        assigned[var]++;
+
+                        auto expr = inst == Assign ? (inst / Rhs) / Expr
+                                                   : Node{};
+                        if (expr && expr->type().in({Add, Sub}) &&
+                            (expr / Lhs) / Expr == Ident &&
+                            cfg->get_var_id((expr / Lhs) / Expr) == var &&
+                            get_atom_int(expr / Rhs)) {
+                            update_of[var] = inst;
+                        }
+                    }
+                }
+
+                // One new variable per induction variable and factor
+                std::map<std::pair<VarId, int>, Node> strength_vars;
+
+                for (uint32_t i : loop.body) {
+                    const Node &inst = cfg->get_instruction(i);
+
+                    if (forest.loop_of[i] != l || inst != Assign ||
+                        (inst / Rhs) / Expr != Mul) {
+                        continue;
+                    }
+
+                    auto mul = (inst / Rhs) / Expr;
+                    auto lhs = mul / Lhs;
+                    auto rhs = mul / Rhs;
+                    auto index = get_atom_int(lhs) ? rhs : lhs;
+                    auto factor = get_atom_int(lhs) ? get_atom_int(lhs)
+                                                    : get_atom_int(rhs);
+
+                    if (!factor || *factor == 0 || *factor == 1 ||
+                        *factor == 2 || index / Expr != Ident) {
+                        continue;
+                    }
+
+                    VarId var = cfg->get_var_id(index / Expr);
+                    if (assigned[var] != 1 || !update_of[var]) {
+                        continue;
+                    }
+
+                    auto [entry, inserted] =
+                        strength_vars.insert({{var, *factor}, Node{}});
+
+                    if (inserted) {
+                        auto name = ast->fresh();
+                        auto update = update_of[var];
+                        auto step = wrapping_mul(
+                            *get_atom_int(((update / Rhs) / Expr) / Rhs),
+                            *factor);
+                        entry->second = Ident ^ name;
+
+                        (*preheaders)[loop_while[l]].push_back(
+                            Stmt << (Var << (Ident ^ name)));
+                        (*preheaders)[loop_while[l]].push_back(
+                            Stmt
+                            << (Assign
+                                << (Ident ^ name)
+                                << (AExpr
+                                    << (Mul << index->clone()
+                                            << (Atom
+                                                << create_const_node(
+                                                       *factor))))));
+
+                        auto op = (update / Rhs) / Expr;
+                        (*updates)[update].push_back(
+                            Stmt
+                            << (Assign
+                                << (Ident ^ name)
+                                << (AExpr
+                                    << ((op == Add ? Add : Sub)
+                                        << (Atom << (Ident ^ name))
+                                        << (Atom
+                                            << create_const_node(step))))));
+                    }
+
+                    reduced->insert({inst, entry->second});
+                }
+            }
+
+            logging::Debug() << "Reducing " << reduced->size()
+                             << " multiplications in loops";
+            return 0;
+        });
+
+        return strength_reduction;
+    }
+}
@@ -0,0 +1,191 @@
+#include "../internal.hh"
+#include "../utils.hh"
+
+namespace whilelang {
+    using namespace trieste;
+
+    namespace {
+        // The constant of every argument of a call, none for arguments that
+        // are not constant
+        using ConstantArgs = std::vector<std::optional<int>>;
+
+        ConstantArgs constant_args(const Node &fun_call) {
+            ConstantArgs args;
+            for (const auto &arg : *(fun_call / ArgList)) {
+                auto expr = (arg / Atom) / Expr;
+                args.push_back(
+                    expr == Int ? std::optional(get_int_value(expr))
+                                : std::nullopt);
+            }
+            return args;
+        }
+
+        // A copy of the function without the parameters that are constant,
+        // which are assigned their constant at the start of the body instead.
+        // Every variable of the copy gets a fresh name, as the analyses
+        // rely on the variables of the program being unique
+        Node specialize(
+            Node ast,
+            const Node &fun_def,
+            const ConstantArgs &args,
+            Location name) {
+            Node params = ParamList;
+            Node body = Block;
+
+            for (size_t i = 0; i < args.size(); i++) {
+                auto param = (fun_def / ParamList)->at(i);
+
+                if (!args[i]) {
+                    params << param->clone();
+                    continue;
+                }
+
+                auto ident = param / Ident;
+                body << (Stmt << (Var << ident->clone()))
+                     << (Stmt
+                         << (Assign
+                             << ident->clone()
+                             << (AExpr
+                                 << (Atom << create_const_node(*args[i])))));
+            }
+
+            body << (fun_def / Body)->clone();
+            Node copy = FunDef << (FunId ^ name) << params << (Stmt << body);
+
+            auto fresh_vars = std::map<Location, Location>();
+            copy->traverse([&](Node node) {
+                if (node != Ident)
+                    return true;
+
+                auto loc = node->location();
+
+                if (fresh_vars.find(loc) == fresh_vars.end()) {
+                    fresh_vars[loc] = ast->fresh();
+                }
+                node->parent()->replace(node, Ident ^ fresh_vars[loc]);
+
+                return true;
+            });
+            return copy;
+        }
+    }
+
+    // Calls passing constants get a copy of the callee with the constants
+    // in place of the parameters, which constant folding then folds into
+    // the body on the next run of the analysis. Only calls too costly to
+    // inline with the inline threshold are specialized, cheaper ones are
+    // better off inlined. Calls with the same constants share a copy. A
+    // function gets at most clone_limit copies over all runs, calls beyond
+    // that keep calling the function itself
+    PassDef specialization(
+        std::shared_ptr<ControlFlow> cfg, size_t inline_threshold) {
+        constexpr size_t clone_limit = 4;
+
+        // Copies made so far of every function, over all runs of the pass
+        auto clone_count = std::make_shared<std::map<std::string, size_t>>();
+
+        // The copy every call is redirected to, and the new copies
+        auto redirects = std::make_shared<NodeMap<Location>>();
+        auto clones = std::make_shared<Nodes>();
+
+        PassDef specialization = {
+            "specialization",
+            normalization_wf,
+            dir::topdown | dir::once,
+            {
+                T(FunCall)[FunCall] >> [=](Match &_) -> Node {
+                    auto res = redirects->find(_(FunCall));
+
+                    if (res == redirects->end()) {
+                        return NoChange;
+                    }
+
+                    auto args = constant_args(_(FunCall));
+                    Node arg_list = ArgList;
+
+                    for (size_t i = 0; i < args.size(); i++) {
+                        if (!args[i]) {
+                            arg_list << (_(FunCall) / ArgList)->at(i)->clone();
+                        }
+                    }
+
+                    return FunCall << (FunId ^ res->second) << arg_list;
+                },
+            }};
+
+        specialization.pre([=](Node ast) {
+            redirects->clear();
+            clones->clear();
+
+            std::map<std::string, Node> fun_defs;
+            for (const auto &fun_def : *ast->front()) {
+                fun_defs.insert({get_identifier(fun_def / FunId), fun_def});
+            }
+
+            std::map<std::string, size_t> call_sites;
+            ast->traverse([&](Node node) {
+                if (node == FunCall) {
+                    call_sites[get_identifier(node / FunId)]++;
+                }
+                return true;
+            });
+
+            std::map<std::pair<std::string, ConstantArgs>, Location> copies;
+
+            ast->traverse([&](Node node) {
+                if (node != FunCall) {
+                    return true;
+                }
+
+                auto fun_id = get_identifier(node / FunId);
+                auto args = constant_args(node);
+                auto fun_def = fun_defs.find(fun_id);
+
+                if (fun_id == "main" || fun_def == fun_defs.end() ||
+                    std::none_of(args.begin(), args.end(), [](auto &arg) {
+                        return arg.has_value();
+                    })) {
+                    return false;
+                }
+
+                size_t cost =
+                    inline_cost(node, fun_def->second, call_sites[fun_id]);
+                if (cost <= inline_limit(node, inline_threshold)) {
+                    return false;
+                }
+
+                auto copy = copies.find({fun_id, args});
+                if (copy == copies.end()) {
+                    if ((*clone_count)[fun_id] >= clone_limit) {
+                        return false;
+                    }
+                    (*clone_count)[fun_id]++;
+
+                    Location name = ast->fresh(Location(fun_id));
+                    clones->push_back(
+                        specialize(ast, fun_def->second, args, name));
+                    copy = copies.insert({{fun_id, args}, name}).first;
+                }
+
+                redirects->insert({node, copy->second});
+                return false;
+            });
+
+            logging::Debug() << "Specializing " << redirects->size()
+                             << " calls with " << clones->size() << " copies";
+            return 0;
+        });
+
+        specialization.post([=](Node ast) {
+            if (clones->empty()) {
+                return 0;
+            }
+
+            ast->front() << *clones;
+            cfg->set_dirty_flag(true);
+            return 0;
+        });
+
+        return specialization;
+    }
+}
@@ -0,0 +1,313 @@
+#include "../internal.hh"
+#include "../utils.hh"
+
+namespace whilelang {
+    using namespace trieste;
+
+    namespace {
+        // A return whose value is the result of calling the function
+        // itself, either directly or combined with a value by an
+        // accumulating operation
+        struct RecursiveReturn {
+            Node ret;
+            Node call;
+            // Add or Mul, none for a plain tail call
+            Node op;
+            Node operand;
+            // The assignments computing the returned value
+            Nodes stmts;
+        };
+
+        // Whether nothing is executed after the statement but the return
+        // of the function, i.e. it ends its block and every block and if
+        // statement around it does so as well, up to the function body
+        bool in_tail_position(Node stmt) {
+            while (true) {
+                Node parent = stmt->parent();
+
+                if (parent == FunDef) {
+                    return true;
+                } else if (parent == Block) {
+                    if (parent->back() != stmt) {
+                        return false;
+                    }
+                    stmt = parent->parent();
+                } else if (parent == If) {
+                    stmt = parent->parent();
+                } else {
+                    return false;
+                }
+            }
+        }
+
+        // The statement right before stmt in its block
+        Node previous_stmt(const Node &stmt) {
+            Node block = stmt->parent();
+            if (block != Block) {
+                return {};
+            }
+
+            auto it = block->find(stmt);
+            if (it == block->begin()) {
+                return {};
+            }
+            return *(it - 1);
+        }
+
+        // The assignment stmt when it is x = rhs, with the rhs of the given
+        // types
+        Node assignment_to(
+            const Node &stmt,
+            const Node &ident,
+            std::initializer_list<Token> types) {
+            if (!stmt || stmt / Stmt != Assign) {
+                return {};
+            }
+
+            Node assign = stmt / Stmt;
+            Node expr = (assign / Rhs) / Expr;
+            if ((assign / Ident)->location().view() !=
+                    ident->location().view() ||
+                !expr->type().in(types)) {
+                return {};
+            }
+            return expr;
+        }
+
+        std::optional<RecursiveReturn>
+        match_recursive_return(const Node &ret, const std::string &name) {
+            Node stmt = ret->parent();
+            Node atom = ret / Atom;
+
+            if (atom / Expr != Ident) {
+                return std::nullopt;
+            }
+
+            Node prev = previous_stmt(stmt);
+            Node expr = assignment_to(prev, atom / Expr, {FunCall, Add, Mul});
+
+            if (!expr) {
+                return std::nullopt;
+            } else if (expr == FunCall) {
+                if (get_identifier(expr / FunId) != name) {
+                    return std::nullopt;
+                }
+                return RecursiveReturn{ret, expr, {}, {}, {prev, stmt}};
+            }
+
+            // x = a op t with t = f(args) right before, the other operand
+            // must not read input as it is read before the call afterwards
+            for (auto [result, operand] :
+                 {std::pair{expr / Lhs, expr / Rhs},
+                  std::pair{expr / Rhs, expr / Lhs}}) {
+                if (result / Expr != Ident || operand / Expr == Input ||
+                    (operand / Expr == Ident &&
+                     (operand / Expr)->location().view() ==
+                         (result / Expr)->location().view())) {
+                    continue;
+                }
+
+                Node call_stmt = previous_stmt(prev);
+                Node call =
+                    assignment_to(call_stmt, result / Expr, {FunCall});
+
+                if (call && get_identifier(call / FunId) == name) {
+                    return RecursiveReturn{
+                        ret, call, expr, operand, {call_stmt, prev, stmt}};
+                }
+            }
+            return std::nullopt;
+        }
+    }
+
+    // Turns functions whose recursive calls are all tail calls into loops.
+    // The body runs in a while loop until a return outside of a recursive
+    // call is reached, a recursive return instead assigns the arguments to
+    // the parameters and runs the body again. A return of a op f(args) with
+    // op Add or Mul is converted as well, when all such returns agree on
+    // the operation: the operands are collected in an accumulator, which
+    // the base case returns are combined with. Both operations wrap around
+    // in int32, so they stay associative and commutative
+    PassDef tail_recursion(std::shared_ptr<ControlFlow> cfg) {
+        PassDef tail_recursion = {
+            "tail_recursion",
+            normalization_wf,
+            dir::topdown | dir::once,
+            {
+                T(FunDef)[FunDef] >> [=](Match &_) -> Node {
+                    auto fun_def = _(FunDef);
+                    auto name = get_identifier(fun_def / FunId);
+                    auto params = fun_def / ParamList;
+                    auto body = fun_def / Body;
+
+                    Nodes returns;
+                    size_t self_calls = 0;
+                    body->traverse([&](Node node) {
+                        if (node == Return) {
+                            returns.push_back(node);
+                        } else if (
+                            node == FunCall &&
+                            get_identifier(node / FunId) == name) {
+                            self_calls++;
+                        }
+                        return true;
+                    });
+
+                    std::vector<RecursiveReturn> recursive;
+                    Nodes base;
+                    Node acc_op;
+
+                    for (const auto &ret : returns) {
+                        if (!in_tail_position(ret->parent())) {
+                            return NoChange;
+                        }
+
+                        auto res = match_recursive_return(ret, name);
+                        if (!res) {
+                            base.push_back(ret);
+                            continue;
+                        }
+
+                        if (res->op) {
+                            if (acc_op && acc_op->type() != res->op->type()) {
+                                return NoChange;
+                            }
+                            acc_op = res->op;
+                        }
+                        recursive.push_back(*res);
+                    }
+
+                    // Every recursive call has to be one of the tail calls
+                    if (recursive.empty() || recursive.size() != self_calls) {
+                        return NoChange;
+                    }
+
+                    Node done = Ident ^ _.fresh();
+                    Node result = Ident ^ _.fresh();
+                    Node acc = Ident ^ _.fresh();
+                    Node cond = Ident ^ _.fresh();
+                    Node loop = Block;
+
+                    loop << (Stmt << (Var << done->clone()))
+                         << (Stmt
+                             << (Assign << done->clone()
+                                        << (BExpr << (BAtom << False))))
+                         << (Stmt << (Var << result->clone()))
+                         << (Stmt << (Var << cond->clone()));
+
+                    if (acc_op) {
+                        loop << (Stmt << (Var << acc->clone()))
+                             << (Stmt
+                                 << (Assign
+                                     << acc->clone()
+                                     << (AExpr
+                                         << (Atom
+                                             << create_const_node(
+                                                    acc_op == Add ? 0 : 1)))));
+                    }
+
+                    // The arguments are copied to temporaries first, as
+                    // they may read the parameters they replace
+                    Nodes temps;
+                    for (size_t i = 0; i < params->size(); i++) {
+                        temps.push_back(Ident ^ _.fresh());
+                        loop << (Stmt << (Var << temps.back()->clone()));
+                    }
+
+                    for (const auto &rec : recursive) {
+                        Node update = Block;
+
+                        if (rec.op) {
+                            update
+                                << (Stmt
+                                    << (Assign
+                                        << acc->clone()
+                                        << (AExpr
+                                            << ((rec.op == Add ? Add : Mul)
+                                                << (Atom << acc->clone())
+                                                << rec.operand->clone()))));
+                        }
+
+                        auto args = rec.call / ArgList;
+                        for (size_t i = 0; i < params->size(); i++) {
+                            update << (Stmt
+                                       << (Assign
+                                           << temps[i]->clone()
+                                           << (AExpr
+                                               << ((args->at(i) / Atom)
+                                                       ->clone()))));
+                        }
+
+                        for (size_t i = 0; i < params->size(); i++) {
+                            update << (Stmt
+                                       << (Assign
+                                           << (params->at(i) / Ident)->clone()
+                                           << (AExpr
+                                               << (Atom
+                                                   << temps[i]->clone()))));
+                        }
+
+                        // The call and the operation leave skips behind,
+                        // which dead code elimination removes
+                        for (size_t i = 0; i + 1 < rec.stmts.size(); i++) {
+                            rec.stmts[i]->parent()->replace(
+                                rec.stmts[i], Stmt << Skip);
+                        }
+
+                        if (update->empty()) {
+                            update << (Stmt << Skip);
+                        }
+
+                        Node ret_stmt = rec.stmts.back();
+                        ret_stmt->parent()->replace(
+                            ret_stmt, Stmt << update);
+                    }
+
+                    for (const auto &ret : base) {
+                        Node value = AExpr << (ret / Atom)->clone();
+
+                        if (acc_op) {
+                            value = AExpr
+                                << ((acc_op == Add ? Add : Mul)
+                                    << (Atom << acc->clone())
+                                    << (ret / Atom)->clone());
+                        }
+
+                        Node ret_stmt = ret->parent();
+                        ret_stmt->parent()->replace(
+                            ret_stmt,
+                            Stmt
+                                << (Block
+                                    << (Stmt
+                                        << (Assign << result->clone()
+                                                   << value))
+                                    << (Stmt
+                                        << (Assign
+                                            << done->clone()
+                                            << (BExpr
+                                                << (BAtom << True))))));
+                    }
+
+                    Node not_done =
+                        BExpr << (Not << (BAtom << done->clone()));
+                    Node header =
+                        Stmt << (Block << (Stmt << (Assign << cond->clone()
+                                                           << not_done)));
+
+                    loop << (Stmt
+                             << (While << header << (BAtom << cond->clone())
+                                       << body))
+                         << (Stmt << (Return << (Atom << result->clone())));
+
+                    logging::Debug() << "Turned the recursion of " << name
+                                     << " into a loop";
+
+                    cfg->set_dirty_flag(true);
+                    return FunDef << (fun_def / FunId) << params
+                                  << (Stmt << loop);
+                },
+            }};
+
+        return tail_recursion;
+    }
+}
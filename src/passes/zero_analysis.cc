@@ -2,22 +2,100 @@
 #include "../analyses/zero.hh"
 #include "../control_flow.hh"
 #include "../internal.hh"
+#include "../utils.hh"
 
 namespace whilelang {
     using namespace trieste;
 
+    namespace {
+        // The outcome of a comparison that the zero abstraction of its
+        // operands decides, a zero can only be compared to itself
+        std::optional<bool> decide_comparison(
+            const Node &op, ZeroLatticeValue lhs, ZeroLatticeValue rhs) {
+            auto zero = ZeroLatticeValue::zero();
+            auto non_zero = ZeroLatticeValue::non_zero();
+
+            if (lhs == zero && rhs == zero) {
+                return op == Equals;
+            } else if (
+                op == Equals && ((lhs == zero && rhs == non_zero) ||
+                                 (lhs == non_zero && rhs == zero))) {
+                return false;
+            }
+            return std::nullopt;
+        }
+    }
+
     PassDef z_analysis(std::shared_ptr<ControlFlow> cfg) {
+        auto analysis = std::make_shared<
+            DataFlowAnalysis<ZeroState, ZeroLatticeValue, ZeroImpl>>();
+
+        auto value_of = [=](const Node &atom, const Node &inst) {
+            return handle_atom(atom / Expr, analysis->get_state(inst), cfg);
+        };
+
         PassDef z_analysis = {
-            "z_analysis", normalization_wf, dir::topdown | dir::once, {}};
+            "z_analysis",
+            normalization_wf,
+            dir::bottomup | dir::once,
+            {
+                // Variables proven to be zero are replaced by the constant,
+                // which later folding and simplification build on
+                In(Atom) * T(Ident)[Ident] >> [=](Match &_) -> Node {
+                    auto inst = fetch_instruction(_(Ident));
+                    auto var = cfg->get_var_id(_(Ident));
 
-        z_analysis.post([=](Node) {
-            auto analysis = std::make_shared<
-                DataFlowAnalysis<ZeroState, ZeroLatticeValue, ZeroImpl>>();
-            auto first_state = ZeroState();
+                    if (analysis->get_state(inst).get(var) ==
+                        ZeroLatticeValue::zero()) {
+                        cfg->record_changed(inst);
+                        return create_const_node(0);
+                    }
+                    return NoChange;
+                },
 
-            for (auto var : cfg->get_vars()) {
-                first_state[var] = ZeroLatticeValue::top();
-            }
+                // A product with a zero factor is zero, unless the other
+                // factor reads input
+                In(AExpr) * T(Mul)[Mul] >> [=](Match &_) -> Node {
+                    auto mul = _(Mul);
+                    auto inst = mul->parent(Assign);
+                    auto lhs = mul / Lhs;
+                    auto rhs = mul / Rhs;
+                    auto zero = ZeroLatticeValue::zero();
+
+                    if ((lhs / Expr) == Input || (rhs / Expr) == Input) {
+                        return NoChange;
+                    } else if (
+                        value_of(lhs, inst) == zero ||
+                        value_of(rhs, inst) == zero) {
+                        cfg->record_changed(inst);
+                        return Atom << create_const_node(0);
+                    }
+                    return NoChange;
+                },
+
+                // Comparisons decided by the zero abstraction become
+                // constants, which lets constant folding and dead code
+                // elimination decide the branches reading them
+                In(BExpr) * T(LT, Equals)[Op] >> [=](Match &_) -> Node {
+                    auto op = _(Op);
+                    auto inst = op->parent(Assign);
+                    auto res = decide_comparison(
+                        op,
+                        value_of(op / Lhs, inst),
+                        value_of(op / Rhs, inst));
+
+                    if (!res) {
+                        return NoChange;
+                    }
+
+                    cfg->record_changed(inst);
+                    return BAtom << (*res ? True : False);
+                },
+            }};
+
+        z_analysis.pre([=](Node) {
+            auto first_state =
+                ZeroState(cfg->get_vars().size(), ZeroLatticeValue::top());
 
             analysis->forward_worklist_algoritm(cfg, first_state);
 
@@ -0,0 +1,298 @@
+#include "ssa.hh"
+
+#include "utils.hh"
+
+namespace whilelang {
+    using namespace trieste;
+
+    namespace {
+        // Variables read by an instruction, sorted and without duplicates.
+        // The arguments of a call are read by the FunCall, not by the
+        // assignment of its result
+        std::vector<VarId>
+        collect_reads(const Node &inst, const std::shared_ptr<ControlFlow> &cfg) {
+            std::vector<VarId> reads;
+
+            if (inst->type().in({FunDef, Var, Skip})) {
+                return reads;
+            }
+
+            if (inst == Assign && (inst / Rhs) / Expr == FunCall) {
+                return reads;
+            }
+
+            if (inst == BAtom) {
+                if (inst / Expr == Ident) {
+                    reads.push_back(cfg->get_var_id(inst / Expr));
+                }
+                return reads;
+            }
+
+            inst->traverse([&](Node curr) {
+                if (curr == Ident && curr->parent()->in({Atom, BAtom})) {
+                    reads.push_back(cfg->get_var_id(curr));
+                }
+                return true;
+            });
+
+            std::sort(reads.begin(), reads.end());
+            reads.erase(std::unique(reads.begin(), reads.end()), reads.end());
+            return reads;
+        }
+    }
+
+    SSA::SSA(std::shared_ptr<ControlFlow> cfg) {
+        if (!cfg->is_frozen()) {
+            throw std::runtime_error("Control flow graph is not frozen");
+        }
+
+        const size_t n = cfg->get_instructions().size();
+        defs_at.resize(n);
+        uses_at.resize(n);
+
+        std::vector<std::vector<VarId>> reads(n);
+        for (uint32_t i = 0; i < n; i++) {
+            reads[i] = collect_reads(cfg->get_instruction(i), cfg);
+        }
+
+        place_phis(cfg, reads);
+        rename(cfg, reads);
+    }
+
+    SSA::Value SSA::use(uint32_t inst, VarId var) const {
+        const auto &uses = uses_at[inst];
+        auto res = std::lower_bound(
+            uses.begin(), uses.end(), var, [](const auto &use, VarId var) {
+                return use.first < var;
+            });
+
+        if (res == uses.end() || res->first != var) {
+            return undefined;
+        }
+        return res->second;
+    }
+
+    void SSA::log(std::shared_ptr<ControlFlow> cfg) const {
+        std::stringstream str_builder;
+        const Vars &vars = cfg->get_vars();
+
+        for (Value v = 0; v < defs.size(); v++) {
+            const auto &def = defs[v];
+            str_builder << "v" << v << " = " << vars.name(def.var);
+
+            if (def.kind == DefKind::Phi) {
+                str_builder << " phi(";
+                for (Value arg : def.args) {
+                    if (arg == undefined) {
+                        str_builder << "undef ";
+                    } else {
+                        str_builder << "v" << arg << " ";
+                    }
+                }
+                str_builder << ")";
+            } else if (def.kind == DefKind::Param) {
+                str_builder << " param";
+            }
+            str_builder << " at " << def.inst + 1 << std::endl;
+        }
+        logging::Debug() << str_builder.str();
+    }
+
+    // Private
+
+    // Places phis at the iterated dominance frontiers of the definitions of
+    // every variable that is read somewhere
+    void SSA::place_phis(
+        const std::shared_ptr<ControlFlow> &cfg,
+        const std::vector<std::vector<VarId>> &reads) {
+        const DominatorTree &dom = cfg->get_dominator_tree();
+        const size_t n = cfg->get_instructions().size();
+        const size_t vars = cfg->get_vars().size();
+
+        std::vector<std::vector<uint32_t>> frontier(n);
+        for (uint32_t b = 0; b < n; b++) {
+            auto preds = cfg->intraprocedural_predecessors(b);
+
+            if (!dom.reachable[b] || preds.size() < 2) {
+                continue;
+            }
+
+            for (uint32_t pred : preds) {
+                if (!dom.reachable[pred]) {
+                    continue;
+                }
+
+                for (uint32_t runner = pred; runner != dom.idom[b];
+                     runner = dom.idom[runner]) {
+                    auto &df = frontier[runner];
+
+                    if (df.empty() || df.back() != b) {
+                        df.push_back(b);
+                    }
+                }
+            }
+        }
+
+        std::vector<uint8_t> is_read(vars, 0);
+        std::vector<std::vector<uint32_t>> def_sites(vars);
+
+        for (uint32_t i = 0; i < n; i++) {
+            for (VarId var : reads[i]) {
+                is_read[var] = 1;
+            }
+
+            const Node &inst = cfg->get_instruction(i);
+            if (inst == Assign) {
+                def_sites[cfg->get_var_id(inst / Ident)].push_back(i);
+            } else if (inst == FunDef) {
+                for (auto param : *(inst / ParamList)) {
+                    def_sites[cfg->get_var_id(param / Ident)].push_back(i);
+                }
+            }
+        }
+
+        // Stamps avoid clearing the markers for every variable
+        std::vector<uint32_t> has_phi(n, UINT32_MAX);
+        std::vector<uint32_t> queued(n, UINT32_MAX);
+        std::vector<uint32_t> worklist;
+
+        for (VarId var = 0; var < vars; var++) {
+            if (!is_read[var]) {
+                continue;
+            }
+
+            worklist = def_sites[var];
+            for (uint32_t site : worklist) {
+                queued[site] = var;
+            }
+
+            while (!worklist.empty()) {
+                uint32_t x = worklist.back();
+                worklist.pop_back();
+
+                for (uint32_t y : frontier[x]) {
+                    if (has_phi[y] == var) {
+                        continue;
+                    }
+
+                    Value phi = add_def(DefKind::Phi, var, y);
+                    defs[phi].args.assign(
+                        cfg->intraprocedural_predecessors(y).size(),
+                        undefined);
+                    has_phi[y] = var;
+
+                    if (queued[y] != var) {
+                        queued[y] = var;
+                        worklist.push_back(y);
+                    }
+                }
+            }
+        }
+    }
+
+    // Walks the dominator tree of every function, keeping a stack of the
+    // reaching definitions of every variable
+    void SSA::rename(
+        const std::shared_ptr<ControlFlow> &cfg,
+        const std::vector<std::vector<VarId>> &reads) {
+        const DominatorTree &dom = cfg->get_dominator_tree();
+        const size_t n = cfg->get_instructions().size();
+        std::vector<std::vector<Value>> reaching(cfg->get_vars().size());
+
+        auto top = [&](VarId var) {
+            return reaching[var].empty() ? undefined : reaching[var].back();
+        };
+
+        struct Frame {
+            uint32_t inst;
+            bool entered;
+            std::vector<VarId> pushed;
+        };
+        std::vector<Frame> stack;
+
+        for (uint32_t root = 0; root < n; root++) {
+            if (cfg->get_instruction(root) != FunDef) {
+                continue;
+            }
+
+            stack.push_back({root, false, {}});
+
+            while (!stack.empty()) {
+                if (stack.back().entered) {
+                    for (VarId var : stack.back().pushed) {
+                        reaching[var].pop_back();
+                    }
+                    stack.pop_back();
+                    continue;
+                }
+
+                stack.back().entered = true;
+                const uint32_t i = stack.back().inst;
+                const Node &inst = cfg->get_instruction(i);
+                std::vector<VarId> pushed;
+
+                for (Value phi : defs_at[i]) {
+                    reaching[defs[phi].var].push_back(phi);
+                    pushed.push_back(defs[phi].var);
+                }
+
+                for (VarId var : reads[i]) {
+                    Value value = top(var);
+                    uses_at[i].push_back({var, value});
+
+                    if (value != undefined) {
+                        inst_users[value].push_back(i);
+                    }
+                }
+
+                if (inst == Assign) {
+                    VarId var = cfg->get_var_id(inst / Ident);
+                    reaching[var].push_back(add_def(DefKind::Assign, var, i));
+                    pushed.push_back(var);
+                } else if (inst == FunDef) {
+                    for (auto param : *(inst / ParamList)) {
+                        VarId var = cfg->get_var_id(param / Ident);
+                        reaching[var].push_back(
+                            add_def(DefKind::Param, var, i));
+                        pushed.push_back(var);
+                    }
+                }
+
+                for (uint32_t succ : cfg->intraprocedural_successors(i)) {
+                    auto preds = cfg->intraprocedural_predecessors(succ);
+                    size_t pos = std::find(preds.begin(), preds.end(), i) -
+                        preds.begin();
+
+                    for (Value phi : defs_at[succ]) {
+                        if (defs[phi].kind != DefKind::Phi) {
+                            continue;
+                        }
+
+                        Value value = top(defs[phi].var);
+                        defs[phi].args[pos] = value;
+
+                        if (value != undefined) {
+                            phi_arg_users[value].push_back(phi);
+                        }
+                    }
+                }
+
+                stack.back().pushed = std::move(pushed);
+                for (uint32_t child : dom.children.neighbours(i)) {
+                    stack.push_back({child, false, {}});
+                }
+            }
+        }
+    }
+
+    SSA::Value SSA::add_def(DefKind kind, VarId var, uint32_t inst) {
+        Value value = defs.size();
+
+        defs.push_back({kind, var, inst, {}});
+        defs_at[inst].push_back(value);
+        inst_users.emplace_back();
+        phi_arg_users.emplace_back();
+
+        return value;
+    }
+}
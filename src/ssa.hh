@@ -0,0 +1,154 @@
+#pragma once
+#include "control_flow.hh"
+
+namespace whilelang {
+    using namespace trieste;
+
+    // Static single assignment view of a frozen ControlFlow. The AST is left
+    // untouched: every definition of a variable (an assignment, a parameter
+    // or a phi at a join point) becomes an SSA value, and every instruction
+    // records which value of each variable it reads. Only intraprocedural
+    // edges are considered, so every function is in SSA form on its own.
+    class SSA {
+      public:
+        using Value = uint32_t;
+
+        // Read of a variable that no definition reaches
+        static constexpr Value undefined = UINT32_MAX;
+
+        enum class DefKind { Param, Assign, Phi };
+
+        struct Definition {
+            DefKind kind;
+            VarId var;
+            // The assignment, the function definition of a parameter or
+            // the join point of a phi
+            uint32_t inst;
+            // Phi arguments, one per intraprocedural predecessor of inst in
+            // the order of ControlFlow::intraprocedural_predecessors
+            std::vector<Value> args;
+        };
+
+        SSA() = default;
+
+        // Builds the SSA form of every function of the frozen cfg
+        explicit SSA(std::shared_ptr<ControlFlow> cfg);
+
+        inline size_t size() const {
+            return defs.size();
+        };
+
+        inline const Definition &definition(Value value) const {
+            return defs[value];
+        };
+
+        // The value of var read by the instruction
+        Value use(uint32_t inst, VarId var) const;
+
+        inline const std::vector<std::pair<VarId, Value>> &
+        uses(uint32_t inst) const {
+            return uses_at[inst];
+        };
+
+        // Values defined by the instruction, its phis first
+        inline const std::vector<Value> &defined_at(uint32_t inst) const {
+            return defs_at[inst];
+        };
+
+        // Instructions reading the value
+        inline const std::vector<uint32_t> &users(Value value) const {
+            return inst_users[value];
+        };
+
+        // Phis taking the value as an argument
+        inline const std::vector<Value> &phi_users(Value value) const {
+            return phi_arg_users[value];
+        };
+
+        // Walks the dominator tree of every function in preorder, keeping
+        // the value of every variable that reaches the current instruction.
+        // enter(inst, reaching) is called once the phis of inst are in
+        // effect but its own definitions are not, where reaching(var) gives
+        // the value of var. leave(inst) follows once its subtree is done
+        template<typename Enter, typename Leave>
+        void walk(
+            const std::shared_ptr<ControlFlow> &cfg,
+            Enter enter,
+            Leave leave) const;
+
+        void log(std::shared_ptr<ControlFlow> cfg) const;
+
+      private:
+        std::vector<Definition> defs;
+        std::vector<std::vector<Value>> defs_at;
+        std::vector<std::vector<std::pair<VarId, Value>>> uses_at;
+        std::vector<std::vector<uint32_t>> inst_users;
+        std::vector<std::vector<Value>> phi_arg_users;
+
+        void place_phis(
+            const std::shared_ptr<ControlFlow> &cfg,
+            const std::vector<std::vector<VarId>> &reads);
+        void rename(
+            const std::shared_ptr<ControlFlow> &cfg,
+            const std::vector<std::vector<VarId>> &reads);
+
+        Value add_def(DefKind kind, VarId var, uint32_t inst);
+    };
+
+    template<typename Enter, typename Leave>
+    void SSA::walk(
+        const std::shared_ptr<ControlFlow> &cfg,
+        Enter enter,
+        Leave leave) const {
+        const DominatorTree &dom = cfg->get_dominator_tree();
+        const size_t n = cfg->get_instructions().size();
+        std::vector<std::vector<Value>> values(cfg->get_vars().size());
+
+        auto reaching = [&](VarId var) {
+            return values[var].empty() ? undefined : values[var].back();
+        };
+
+        // Instructions paired with whether they were entered
+        std::vector<std::pair<uint32_t, bool>> stack;
+
+        for (uint32_t root = 0; root < n; root++) {
+            if (cfg->get_instruction(root) != FunDef) {
+                continue;
+            }
+
+            stack.push_back({root, false});
+
+            while (!stack.empty()) {
+                auto [inst, entered] = stack.back();
+
+                if (entered) {
+                    for (Value value : defs_at[inst]) {
+                        values[defs[value].var].pop_back();
+                    }
+                    leave(inst);
+                    stack.pop_back();
+                    continue;
+                }
+                stack.back().second = true;
+
+                for (Value value : defs_at[inst]) {
+                    if (defs[value].kind == DefKind::Phi) {
+                        values[defs[value].var].push_back(value);
+                    }
+                }
+
+                enter(inst, reaching);
+
+                for (Value value : defs_at[inst]) {
+                    if (defs[value].kind != DefKind::Phi) {
+                        values[defs[value].var].push_back(value);
+                    }
+                }
+
+                for (uint32_t child : dom.children.neighbours(inst)) {
+                    stack.push_back({child, false});
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "lang.hh"
+
+namespace whilelang {
+    using namespace trieste;
+
+    // Compact identifier of an interned variable
+    using VarId = uint32_t;
+
+    // Interns the variables of a program, mapping every identifier to a
+    // dense VarId in the order they are first seen. Lookups hash the
+    // identifier's location view and never allocate.
+    class SymbolTable {
+      public:
+        VarId intern(const Node &ident) {
+            const Location &loc = ident->location();
+            auto res = ids.find(loc.view());
+
+            if (res != ids.end()) {
+                return res->second;
+            }
+
+            VarId id = static_cast<VarId>(names.size());
+            names.push_back(loc);
+            ids.insert({names.back().view(), id});
+
+            return id;
+        }
+
+        VarId id(const Node &ident) const {
+            auto res = ids.find(ident->location().view());
+
+            if (res == ids.end()) {
+                throw std::runtime_error(
+                    "Unknown variable " + std::string(ident->location().view()));
+            }
+            return res->second;
+        }
+
+        bool contains(const Node &ident) const {
+            return ids.contains(ident->location().view());
+        }
+
+        std::string_view name(VarId id) const {
+            return names[id].view();
+        }
+
+        size_t size() const {
+            return names.size();
+        }
+
+        void clear() {
+            ids.clear();
+            names.clear();
+        }
+
+      private:
+        // The locations keep the sources alive which the views in ids
+        // point into
+        std::vector<Location> names;
+        std::unordered_map<std::string_view, VarId> ids;
+    };
+}
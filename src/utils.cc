@@ -53,6 +53,18 @@ namespace whilelang {
         return children;
     }
 
+    Node fetch_instruction(const Node &n) {
+        auto curr = n;
+
+        while (!curr->type().in(
+            {If, While, Assign, FunCall, FunDef, Output, Return})) {
+            curr = curr->parent();
+        }
+        if (curr->type().in({If, While}))
+            return curr / BAtom;
+        return curr;
+    }
+
     int get_int_value(const Node &node) {
         std::string text(node->location().view());
         return std::stoi(text);
@@ -76,6 +88,44 @@ namespace whilelang {
         return Int ^ std::to_string(value);
     };
 
+    size_t body_size(const Node &fun_def) {
+        size_t size = 0;
+        (fun_def / Body)->traverse([&](Node node) {
+            if (node == Stmt && node / Stmt != Block) {
+                size++;
+            }
+            return true;
+        });
+        return size;
+    }
+
+    size_t inline_cost(
+        const Node &fun_call, const Node &fun_def, size_t call_sites) {
+        // Bonus per argument that is a constant
+        constexpr size_t constant_arg_bonus = 5;
+
+        size_t constant_args = 0;
+        for (const auto &arg : *(fun_call / ArgList)) {
+            constant_args += (arg / Atom) / Expr == Int;
+        }
+
+        size_t size = body_size(fun_def);
+        size_t bonus = constant_args * constant_arg_bonus +
+            size / std::max<size_t>(call_sites, 1);
+        return size > bonus ? size - bonus : 0;
+    }
+
+    size_t inline_limit(const Node &fun_call, size_t threshold) {
+        size_t depth = 0;
+        for (Node node = fun_call; node && node != FunDef;
+             node = node->parent()) {
+            if (node == While) {
+                depth++;
+            }
+        }
+        return threshold * (1 + depth);
+    }
+
     void
     log_var_map(std::shared_ptr<std::map<std::string, std::string>> vars_map) {
         const int width = 10;
@@ -10,6 +10,9 @@ namespace whilelang {
 
     NodeSet get_last_basic_children(Node n);
 
+    // The instruction of the control flow graph containing the node
+    Node fetch_instruction(const Node &n);
+
     int get_int_value(const Node &node);
 
     std::string get_identifier(const Node &node);
@@ -18,5 +21,20 @@ namespace whilelang {
 
     Node create_const_node(int value);
 
+    // Normalized statements of a function body, not counting the
+    // statements that only wrap blocks
+    size_t body_size(const Node &fun_def);
+
+    // Cost model of inlining. The cost of a call is the size of the callee
+    // less a bonus for every constant argument, which folds once inlined,
+    // and less an equal share of the size for each of the call_sites of the
+    // callee, which is removed once they are all inlined. A call is inlined
+    // when its cost is at most the limit, which grows with the loop depth
+    // of the call
+    size_t inline_cost(
+        const Node &fun_call, const Node &fun_def, size_t call_sites);
+
+    size_t inline_limit(const Node &fun_call, size_t threshold);
+
 	void log_var_map(std::shared_ptr<std::map<std::string, std::string>> vars_map);
 }
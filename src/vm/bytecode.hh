@@ -0,0 +1,113 @@
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace whilelang::vm {
+    // The code of a program is one flat sequence of 32 bit words, every
+    // instruction is an opcode followed by its operands. Registers are
+    // numbered within the frame of the running function, jump targets are
+    // offsets into the code and callees are indices into the functions
+    enum class Op : uint32_t {
+        // dst imm
+        Const,
+        // dst src
+        Copy,
+        // dst lhs rhs
+        Add,
+        Sub,
+        Mul,
+        Lt,
+        Eq,
+        And,
+        Or,
+        // dst src
+        Not,
+        // dst
+        Input,
+        // src
+        Output,
+        // dst function argc args...
+        Call,
+        // target
+        Jump,
+        // src then else
+        Cond,
+        // src
+        Return,
+
+        // Superinstructions fused from frequent shapes of the normalized
+        // code, see lower_bytecode
+
+        // dst src imm, also covers Sub with a constant
+        AddImm,
+        // dst lhs rhs then else, the comparison is written to dst as well
+        LtCond,
+        EqCond,
+    };
+
+    // Frame registers below this number are kept in machine registers by
+    // the JIT, register allocation gives them to the values it prefers
+    constexpr uint32_t machine_registers = 4;
+
+    struct Function {
+        std::string name;
+        uint32_t entry;
+        uint32_t params;
+        // Size of the frame, the parameters come first
+        uint32_t registers;
+    };
+
+    struct Program {
+        std::vector<uint32_t> code;
+        std::vector<Function> functions;
+        uint32_t main = 0;
+    };
+
+    // Maps the registers of every function onto as few frame registers as
+    // possible by linear scan, see register_allocation.cc
+    void allocate_registers(Program &program);
+
+    struct Stats {
+        // Instructions run by the interpreter, not counting machine code
+        uint64_t executed = 0;
+        size_t compiled_functions = 0;
+        size_t machine_code_bytes = 0;
+    };
+
+    // Runs main to completion and returns its result. Input is read from
+    // in and output written to out. With a jit threshold a function is
+    // compiled to machine code once its invocations and loop iterations
+    // add up to the threshold
+    int32_t
+    run(const Program &program,
+        std::istream &in,
+        std::ostream &out,
+        Stats &stats,
+        std::optional<uint64_t> jit_threshold = std::nullopt);
+
+    // Number of words of the instruction starting at pc
+    inline uint32_t
+    instruction_size(const std::vector<uint32_t> &code, uint32_t pc) {
+        switch (static_cast<Op>(code[pc])) {
+            case Op::Input:
+            case Op::Output:
+            case Op::Jump:
+            case Op::Return:
+                return 2;
+            case Op::Const:
+            case Op::Copy:
+            case Op::Not:
+                return 3;
+            case Op::Call:
+                return 4 + code[pc + 3];
+            case Op::LtCond:
+            case Op::EqCond:
+                return 6;
+            default:
+                return 4;
+        }
+    }
+}
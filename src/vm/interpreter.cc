@@ -0,0 +1,438 @@
+#include "bytecode.hh"
+#include "jit.hh"
+
+// GCC and Clang dispatch on the address of the next handler (direct
+// threading), other compilers fall back to a switch in a loop. Defining
+// WHILE_VM_SWITCH_DISPATCH forces the fallback for comparison
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    !defined(WHILE_VM_SWITCH_DISPATCH)
+#    define WHILE_VM_THREADED 1
+#else
+#    define WHILE_VM_THREADED 0
+#endif
+
+namespace whilelang::vm {
+    namespace {
+        // Where execution continues once the running function returns
+        struct Frame {
+            uint32_t function;
+            size_t return_pc;
+            size_t base;
+            uint32_t dst;
+        };
+
+        // Arithmetic wraps around like the int32 operations of the VIR
+        // backend, without the undefined behaviour of signed overflow
+        inline int32_t wrap(uint32_t value) {
+            return static_cast<int32_t>(value);
+        }
+
+        // The state of a run, shared by the interpreter and the machine
+        // code of the hot functions
+        struct Runtime {
+            const Program &program;
+            std::istream &in;
+            std::ostream &out;
+            Stats &stats;
+            std::optional<uint64_t> jit_threshold;
+            JitHelpers helpers;
+
+            // The frames of all active calls, one after the other
+            std::vector<int32_t> stack;
+            std::vector<Frame> frames;
+
+            // The code with every opcode replaced by the address of its
+            // handler, created by the first call of interpret
+            std::vector<uintptr_t> threaded;
+
+            // Invocations and back edges taken of every function, and its
+            // machine code once these reach the threshold
+            std::vector<uint64_t> heat;
+            std::vector<std::unique_ptr<JitFunction>> native;
+
+            // Machine code keeps its frames on the native stack, and every
+            // call it makes recurses there. Past this many nested runs of
+            // machine code, functions are interpreted with their frames on
+            // the heap instead, so deep recursion does not overflow it
+            static constexpr size_t max_native_depth = 1000;
+            size_t native_depth = 0;
+
+            int32_t *frame(size_t base) {
+                return stack.data() + base;
+            }
+
+            void reserve(size_t top) {
+                if (stack.size() < top) {
+                    stack.resize(std::max(stack.size() * 2, top));
+                }
+            }
+
+            // Counts an invocation or back edge of the function and returns
+            // whether it runs as machine code from now on
+            bool hot(uint32_t function) {
+                if (native_depth >= max_native_depth) {
+                    return false;
+                } else if (native[function]) {
+                    return true;
+                } else if (
+                    !jit_threshold || ++heat[function] != *jit_threshold) {
+                    return false;
+                }
+
+                native[function] = jit_compile(program, function, helpers);
+                if (!native[function]) {
+                    return false;
+                }
+
+                stats.compiled_functions++;
+                stats.machine_code_bytes += native[function]->size();
+                return true;
+            }
+
+            // Runs the machine code of a hot function from the instruction
+            // at pc
+            int32_t
+            run_native(uint32_t function, int32_t *regs, uint32_t pc) {
+                native_depth++;
+                int32_t value = native[function]->run(regs, this, pc);
+                native_depth--;
+                return value;
+            }
+
+            int32_t read_input() {
+                // Same prompt as the input function of the runtime library
+                out << "input: " << std::flush;
+                int32_t value = 0;
+                in >> value;
+                return value;
+            }
+
+            void write_output(int32_t value) {
+                out << value << std::endl;
+            }
+        };
+
+        int32_t interpret(Runtime &rt, uint32_t function, size_t base);
+
+        // Runs the function whose arguments are in place at base
+        int32_t invoke(Runtime &rt, uint32_t function, size_t base) {
+            if (rt.hot(function)) {
+                return rt.run_native(
+                    function,
+                    rt.frame(base),
+                    rt.program.functions[function].entry);
+            }
+            return interpret(rt, function, base);
+        }
+
+        int32_t jit_input(void *runtime) {
+            return static_cast<Runtime *>(runtime)->read_input();
+        }
+
+        void jit_output(void *runtime, int32_t value) {
+            static_cast<Runtime *>(runtime)->write_output(value);
+        }
+
+        int32_t *
+        jit_call(void *runtime, int32_t *regs, uint32_t pc, uint32_t function) {
+            auto &rt = *static_cast<Runtime *>(runtime);
+            const uint32_t *ops = &rt.program.code[pc + 1];
+            const Function &callee = rt.program.functions[ops[1]];
+
+            size_t base = regs - rt.stack.data();
+            size_t callee_base =
+                base + rt.program.functions[function].registers;
+
+            rt.reserve(callee_base + callee.registers);
+            regs = rt.frame(base);
+            for (uint32_t i = 0; i < ops[2]; i++) {
+                rt.stack[callee_base + i] = regs[ops[3 + i]];
+            }
+
+            int32_t value = invoke(rt, ops[1], callee_base);
+            regs = rt.frame(base);
+            regs[ops[0]] = value;
+            return regs;
+        }
+
+        // Runs the function at base until it returns. Calls to functions
+        // without machine code are run by the same loop, which returns
+        // once the frame it started with returns
+        int32_t interpret(Runtime &rt, uint32_t function, size_t base) {
+#if WHILE_VM_THREADED
+            // In the same order as Op
+            static const void *const handlers[] = {
+                &&op_Const,
+                &&op_Copy,
+                &&op_Add,
+                &&op_Sub,
+                &&op_Mul,
+                &&op_Lt,
+                &&op_Eq,
+                &&op_And,
+                &&op_Or,
+                &&op_Not,
+                &&op_Input,
+                &&op_Output,
+                &&op_Call,
+                &&op_Jump,
+                &&op_Cond,
+                &&op_Return,
+                &&op_AddImm,
+                &&op_LtCond,
+                &&op_EqCond,
+            };
+
+            const auto &program = rt.program.code;
+            if (rt.threaded.empty()) {
+                rt.threaded.assign(program.begin(), program.end());
+                for (uint32_t pc = 0; pc < program.size();
+                     pc += instruction_size(program, pc)) {
+                    rt.threaded[pc] =
+                        reinterpret_cast<uintptr_t>(handlers[program[pc]]);
+                }
+            }
+            const uintptr_t *const start = rt.threaded.data();
+
+#    define CASE(name) op_##name:
+#    define DISPATCH()                                     \
+        do {                                               \
+            rt.stats.executed++;                           \
+            goto *reinterpret_cast<const void *>(*ip);     \
+        } while (0)
+#else
+            const uint32_t *const start = rt.program.code.data();
+
+#    define CASE(name) case Op::name:
+#    define DISPATCH() continue
+#endif
+
+// A branch to a lower offset is a back edge of a loop. Once the function
+// is hot the loop continues in machine code until the function returns
+#define BRANCH(target)                                                 \
+    {                                                                  \
+        uint32_t to = (target);                                        \
+        if (to < static_cast<uint32_t>(ip - start) &&                  \
+            rt.hot(function)) {                                        \
+            value = rt.run_native(function, regs, to);                 \
+            goto returned;                                             \
+        }                                                              \
+        ip = start + to;                                               \
+        DISPATCH();                                                    \
+    }
+
+            const size_t bottom = rt.frames.size();
+            int32_t *regs = rt.frame(base);
+            auto ip = start + rt.program.functions[function].entry;
+            int32_t value = 0;
+
+#if WHILE_VM_THREADED
+            DISPATCH();
+#else
+            while (true) {
+                rt.stats.executed++;
+                switch (static_cast<Op>(*ip)) {
+#endif
+                    CASE(Const) {
+                        regs[ip[1]] = static_cast<int32_t>(ip[2]);
+                        ip += 3;
+                        DISPATCH();
+                    }
+
+                    CASE(Copy) {
+                        regs[ip[1]] = regs[ip[2]];
+                        ip += 3;
+                        DISPATCH();
+                    }
+
+                    CASE(Add) {
+                        regs[ip[1]] = wrap(
+                            static_cast<uint32_t>(regs[ip[2]]) +
+                            static_cast<uint32_t>(regs[ip[3]]));
+                        ip += 4;
+                        DISPATCH();
+                    }
+
+                    CASE(Sub) {
+                        regs[ip[1]] = wrap(
+                            static_cast<uint32_t>(regs[ip[2]]) -
+                            static_cast<uint32_t>(regs[ip[3]]));
+                        ip += 4;
+                        DISPATCH();
+                    }
+
+                    CASE(Mul) {
+                        regs[ip[1]] = wrap(
+                            static_cast<uint32_t>(regs[ip[2]]) *
+                            static_cast<uint32_t>(regs[ip[3]]));
+                        ip += 4;
+                        DISPATCH();
+                    }
+
+                    CASE(Lt) {
+                        regs[ip[1]] = regs[ip[2]] < regs[ip[3]];
+                        ip += 4;
+                        DISPATCH();
+                    }
+
+                    CASE(Eq) {
+                        regs[ip[1]] = regs[ip[2]] == regs[ip[3]];
+                        ip += 4;
+                        DISPATCH();
+                    }
+
+                    CASE(And) {
+                        regs[ip[1]] = regs[ip[2]] & regs[ip[3]];
+                        ip += 4;
+                        DISPATCH();
+                    }
+
+                    CASE(Or) {
+                        regs[ip[1]] = regs[ip[2]] | regs[ip[3]];
+                        ip += 4;
+                        DISPATCH();
+                    }
+
+                    CASE(Not) {
+                        regs[ip[1]] = !regs[ip[2]];
+                        ip += 3;
+                        DISPATCH();
+                    }
+
+                    CASE(Input) {
+                        regs[ip[1]] = rt.read_input();
+                        ip += 2;
+                        DISPATCH();
+                    }
+
+                    CASE(Output) {
+                        rt.write_output(regs[ip[1]]);
+                        ip += 2;
+                        DISPATCH();
+                    }
+
+                    CASE(Call) {
+                        uint32_t callee_index = ip[2];
+                        const Function &callee =
+                            rt.program.functions[callee_index];
+                        size_t callee_base =
+                            base + rt.program.functions[function].registers;
+
+                        rt.reserve(callee_base + callee.registers);
+                        regs = rt.frame(base);
+
+                        int32_t *callee_regs = rt.frame(callee_base);
+                        for (uint32_t i = 0; i < ip[3]; i++) {
+                            callee_regs[i] = regs[ip[4 + i]];
+                        }
+
+                        if (rt.hot(callee_index)) {
+                            int32_t res = rt.run_native(
+                                callee_index, callee_regs, callee.entry);
+                            regs = rt.frame(base);
+                            regs[ip[1]] = res;
+                            ip += 4 + ip[3];
+                            DISPATCH();
+                        }
+
+                        size_t return_pc = (ip - start) + 4 + ip[3];
+                        rt.frames.push_back(
+                            {function,
+                             return_pc,
+                             base,
+                             static_cast<uint32_t>(ip[1])});
+                        function = callee_index;
+                        base = callee_base;
+                        regs = callee_regs;
+                        ip = start + callee.entry;
+                        DISPATCH();
+                    }
+
+                    CASE(Jump) {
+                        BRANCH(ip[1]);
+                    }
+
+                    CASE(Cond) {
+                        BRANCH(regs[ip[1]] ? ip[2] : ip[3]);
+                    }
+
+                    CASE(Return) {
+                        value = regs[ip[1]];
+                    returned:
+                        if (rt.frames.size() == bottom) {
+                            return value;
+                        }
+
+                        Frame frame = rt.frames.back();
+                        rt.frames.pop_back();
+
+                        function = frame.function;
+                        base = frame.base;
+                        regs = rt.frame(base);
+                        regs[frame.dst] = value;
+                        ip = start + frame.return_pc;
+                        DISPATCH();
+                    }
+
+                    CASE(AddImm) {
+                        regs[ip[1]] = wrap(
+                            static_cast<uint32_t>(regs[ip[2]]) +
+                            static_cast<uint32_t>(ip[3]));
+                        ip += 4;
+                        DISPATCH();
+                    }
+
+                    CASE(LtCond) {
+                        bool res = regs[ip[2]] < regs[ip[3]];
+                        regs[ip[1]] = res;
+                        BRANCH(res ? ip[4] : ip[5]);
+                    }
+
+                    CASE(EqCond) {
+                        bool res = regs[ip[2]] == regs[ip[3]];
+                        regs[ip[1]] = res;
+                        BRANCH(res ? ip[4] : ip[5]);
+                    }
+#if !WHILE_VM_THREADED
+                }
+            }
+#endif
+
+#undef CASE
+#undef DISPATCH
+#undef BRANCH
+        }
+    }
+
+    int32_t
+    run(const Program &program,
+        std::istream &in,
+        std::ostream &out,
+        Stats &stats,
+        std::optional<uint64_t> jit_threshold) {
+        stats = Stats();
+
+        // A threshold of zero compiles every function on its first entry,
+        // like a threshold of one
+        if (jit_threshold) {
+            jit_threshold = std::max<uint64_t>(*jit_threshold, 1);
+        }
+
+        Runtime rt{
+            program,
+            in,
+            out,
+            stats,
+            jit_threshold,
+            {jit_input, jit_output, jit_call},
+            std::vector<int32_t>(program.functions[program.main].registers),
+            {},
+            {},
+            std::vector<uint64_t>(program.functions.size()),
+            std::vector<std::unique_ptr<JitFunction>>(
+                program.functions.size()),
+        };
+
+        return invoke(rt, program.main, 0);
+    }
+}
@@ -0,0 +1,367 @@
+#include "jit.hh"
+
+#if WHILE_VM_JIT
+#    include <sys/mman.h>
+#    include <unistd.h>
+#endif
+
+#include <cstring>
+#include <stdexcept>
+
+namespace whilelang::vm {
+    JitFunction::JitFunction(
+        void *code, size_t size, std::vector<uint32_t> offsets, uint32_t entry)
+        : code(code), code_size(size), offsets(std::move(offsets)),
+          entry(entry) {}
+
+    JitFunction::~JitFunction() {
+#if WHILE_VM_JIT
+        munmap(code, code_size);
+#endif
+    }
+
+    int32_t JitFunction::run(int32_t *regs, void *runtime, uint32_t pc) const {
+        auto start = reinterpret_cast<Code>(code);
+        auto target = static_cast<const uint8_t *>(code) + offsets[pc - entry];
+        return start(regs, runtime, target);
+    }
+
+#if WHILE_VM_JIT
+    namespace {
+        // Machine registers holding the first frame registers, all callee
+        // saved so that they survive the calls into the runtime
+        constexpr uint8_t cached_regs[machine_registers] = {5, 13, 14, 15};
+
+        // Emits the few x86-64 instructions the code generator needs. The
+        // frame is addressed relative to rbx, its first registers are kept
+        // in machine registers. The runtime is kept in r12 for the calls
+        // back into the interpreter
+        class X86Emitter {
+          public:
+            std::vector<uint8_t> bytes;
+
+            // Number of frame registers kept in machine registers
+            explicit X86Emitter(uint32_t cached) : cached(cached) {}
+
+            void emit(std::initializer_list<uint8_t> code) {
+                bytes.insert(bytes.end(), code.begin(), code.end());
+            }
+
+            void imm32(uint32_t value) {
+                for (int i = 0; i < 4; i++) {
+                    bytes.push_back((value >> (8 * i)) & 0xff);
+                }
+            }
+
+            void imm64(uint64_t value) {
+                imm32(static_cast<uint32_t>(value));
+                imm32(static_cast<uint32_t>(value >> 32));
+            }
+
+            // op eax, reg for the given opcode bytes, where reg is a machine
+            // register or [rbx + 4 * reg]
+            void eax_frame(const std::vector<uint8_t> &op, uint32_t reg) {
+                modrm(op, 0, reg);
+            }
+
+            void load(uint32_t reg) {
+                eax_frame({0x8b}, reg);
+            }
+
+            void store(uint32_t reg) {
+                eax_frame({0x89}, reg);
+            }
+
+            // mov dword reg, imm
+            void store_imm(uint32_t reg, uint32_t imm) {
+                modrm({0xc7}, 0, reg);
+                imm32(imm);
+            }
+
+            // Writes the machine registers back to the frame, or reloads
+            // them from it
+            void write_back() {
+                for (uint32_t reg = 0; reg < cached; reg++) {
+                    frame_access(0x89, reg);
+                }
+            }
+
+            void reload() {
+                for (uint32_t reg = 0; reg < cached; reg++) {
+                    frame_access(0x8b, reg);
+                }
+            }
+
+            // eax = cc ? 1 : 0 for the condition code of a setcc
+            void set_condition(uint8_t cc) {
+                emit({0x0f, cc, 0xc0, 0x0f, 0xb6, 0xc0});
+            }
+
+            // Returns the position of the rel32 to patch
+            size_t jump() {
+                emit({0xe9});
+                imm32(0);
+                return bytes.size() - 4;
+            }
+
+            size_t jump_if_nonzero() {
+                emit({0x85, 0xc0, 0x0f, 0x85});
+                imm32(0);
+                return bytes.size() - 4;
+            }
+
+            void call(const void *fn) {
+                // mov rax, fn; call rax
+                emit({0x48, 0xb8});
+                imm64(reinterpret_cast<uint64_t>(fn));
+                emit({0xff, 0xd0});
+            }
+
+            void prologue() {
+                // push rbx, r12, r13, r14, r15 and rbp; sub rsp, 8 keeps
+                // the stack 16 byte aligned for the calls
+                emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+                emit({0x55, 0x48, 0x83, 0xec, 0x08});
+                // mov rbx, rdi; mov r12, rsi
+                emit({0x48, 0x89, 0xfb, 0x49, 0x89, 0xf4});
+                reload();
+                // jmp rdx
+                emit({0xff, 0xe2});
+            }
+
+            void epilogue() {
+                // add rsp, 8; pop rbp, r15, r14, r13, r12 and rbx; ret
+                emit({0x48, 0x83, 0xc4, 0x08, 0x5d, 0x41, 0x5f, 0x41, 0x5e});
+                emit({0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3});
+            }
+
+            // mov rdi, r12
+            void runtime_arg() {
+                emit({0x4c, 0x89, 0xe7});
+            }
+
+          private:
+            uint32_t cached;
+
+            // op with the given reg field and reg as the r/m operand
+            void modrm(
+                const std::vector<uint8_t> &op, uint8_t field, uint32_t reg) {
+                if (reg < cached) {
+                    uint8_t code = cached_regs[reg];
+                    if (code >= 8) {
+                        bytes.push_back(0x41);
+                    }
+                    bytes.insert(bytes.end(), op.begin(), op.end());
+                    bytes.push_back(0xc0 | (field << 3) | (code & 7));
+                    return;
+                }
+
+                bytes.insert(bytes.end(), op.begin(), op.end());
+                bytes.push_back(0x83 | (field << 3));
+                imm32(4 * reg);
+            }
+
+            // op machine register, [rbx + 4 * reg] for the machine register
+            // caching reg
+            void frame_access(uint8_t op, uint32_t reg) {
+                uint8_t code = cached_regs[reg];
+                if (code >= 8) {
+                    bytes.push_back(0x44);
+                }
+                bytes.push_back(op);
+                bytes.push_back(0x83 | ((code & 7) << 3));
+                imm32(4 * reg);
+            }
+        };
+
+        // Opcode bytes of op eax, [mem] for the binary operations
+        std::vector<uint8_t> arithmetic(Op op) {
+            switch (op) {
+                case Op::Add:
+                    return {0x03};
+                case Op::Sub:
+                    return {0x2b};
+                case Op::Mul:
+                    return {0x0f, 0xaf};
+                case Op::And:
+                    return {0x23};
+                case Op::Or:
+                    return {0x0b};
+                default:
+                    throw std::runtime_error("Not an arithmetic operation");
+            }
+        }
+
+        uint32_t function_end(const Program &program, uint32_t function) {
+            uint32_t entry = program.functions[function].entry;
+            uint32_t end = program.code.size();
+            for (const auto &other : program.functions) {
+                if (other.entry > entry && other.entry < end) {
+                    end = other.entry;
+                }
+            }
+            return end;
+        }
+    }
+
+    std::unique_ptr<JitFunction> jit_compile(
+        const Program &program, uint32_t function, const JitHelpers &helpers) {
+        const auto &code = program.code;
+        uint32_t entry = program.functions[function].entry;
+        uint32_t end = function_end(program, function);
+
+        X86Emitter x86(
+            std::min(machine_registers, program.functions[function].registers));
+        std::vector<uint32_t> offsets(end - entry);
+        std::vector<std::pair<size_t, uint32_t>> fixups;
+
+        auto branch = [&](size_t pos, uint32_t target) {
+            fixups.push_back({pos, target});
+        };
+
+        x86.prologue();
+
+        for (uint32_t pc = entry; pc < end;
+             pc += instruction_size(code, pc)) {
+            offsets[pc - entry] = x86.bytes.size();
+            auto op = static_cast<Op>(code[pc]);
+            const uint32_t *ops = &code[pc + 1];
+
+            switch (op) {
+                case Op::Const:
+                    x86.store_imm(ops[0], ops[1]);
+                    break;
+
+                case Op::Copy:
+                    x86.load(ops[1]);
+                    x86.store(ops[0]);
+                    break;
+
+                case Op::Add:
+                case Op::Sub:
+                case Op::Mul:
+                case Op::And:
+                case Op::Or:
+                    x86.load(ops[1]);
+                    x86.eax_frame(arithmetic(op), ops[2]);
+                    x86.store(ops[0]);
+                    break;
+
+                case Op::Lt:
+                case Op::Eq:
+                case Op::LtCond:
+                case Op::EqCond: {
+                    // cmp eax, [mem]; setl or sete
+                    bool lt = op == Op::Lt || op == Op::LtCond;
+                    x86.load(ops[1]);
+                    x86.eax_frame({0x3b}, ops[2]);
+                    x86.set_condition(lt ? 0x9c : 0x94);
+                    x86.store(ops[0]);
+
+                    if (op == Op::LtCond || op == Op::EqCond) {
+                        branch(x86.jump_if_nonzero(), ops[3]);
+                        branch(x86.jump(), ops[4]);
+                    }
+                    break;
+                }
+
+                case Op::Not:
+                    // test eax, eax; sete
+                    x86.load(ops[1]);
+                    x86.emit({0x85, 0xc0});
+                    x86.set_condition(0x94);
+                    x86.store(ops[0]);
+                    break;
+
+                case Op::AddImm:
+                    // add eax, imm
+                    x86.load(ops[1]);
+                    x86.emit({0x05});
+                    x86.imm32(ops[2]);
+                    x86.store(ops[0]);
+                    break;
+
+                case Op::Input:
+                    x86.runtime_arg();
+                    x86.call(reinterpret_cast<const void *>(helpers.input));
+                    x86.store(ops[0]);
+                    break;
+
+                case Op::Output:
+                    // mov esi, eax
+                    x86.load(ops[0]);
+                    x86.emit({0x89, 0xc6});
+                    x86.runtime_arg();
+                    x86.call(reinterpret_cast<const void *>(helpers.output));
+                    break;
+
+                case Op::Call:
+                    // The runtime reads the arguments from the frame and
+                    // writes the result to it. mov rsi, rbx; mov edx, pc;
+                    // mov ecx, function, then mov rbx, rax for the frame
+                    // that may have moved
+                    x86.write_back();
+                    x86.runtime_arg();
+                    x86.emit({0x48, 0x89, 0xde, 0xba});
+                    x86.imm32(pc);
+                    x86.emit({0xb9});
+                    x86.imm32(function);
+                    x86.call(reinterpret_cast<const void *>(helpers.call));
+                    x86.emit({0x48, 0x89, 0xc3});
+                    x86.reload();
+                    break;
+
+                case Op::Jump:
+                    branch(x86.jump(), ops[0]);
+                    break;
+
+                case Op::Cond:
+                    x86.load(ops[0]);
+                    branch(x86.jump_if_nonzero(), ops[1]);
+                    branch(x86.jump(), ops[2]);
+                    break;
+
+                case Op::Return:
+                    x86.load(ops[0]);
+                    x86.epilogue();
+                    break;
+            }
+        }
+
+        for (const auto &[pos, target] : fixups) {
+            int32_t rel = static_cast<int32_t>(offsets[target - entry]) -
+                static_cast<int32_t>(pos + 4);
+            std::memcpy(&x86.bytes[pos], &rel, sizeof(rel));
+        }
+
+        // The code is written to a writable mapping that is then made
+        // executable, it is never writable and executable at once
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t size = (x86.bytes.size() + page - 1) / page * page;
+        void *mem = mmap(
+            nullptr,
+            size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0);
+        if (mem == MAP_FAILED) {
+            return nullptr;
+        }
+
+        std::memcpy(mem, x86.bytes.data(), x86.bytes.size());
+        if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(mem, size);
+            return nullptr;
+        }
+
+        return std::make_unique<JitFunction>(
+            mem, x86.bytes.size(), std::move(offsets), entry);
+    }
+#else
+    std::unique_ptr<JitFunction>
+    jit_compile(const Program &, uint32_t, const JitHelpers &) {
+        return nullptr;
+    }
+#endif
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "bytecode.hh"
+
+#include <memory>
+
+// Machine code is only generated for x86-64 on systems with mmap, the
+// interpreter runs everything elsewhere
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#    define WHILE_VM_JIT 1
+#else
+#    define WHILE_VM_JIT 0
+#endif
+
+namespace whilelang::vm {
+    // Functions of the interpreter that machine code calls back into, the
+    // runtime is passed through untouched
+    struct JitHelpers {
+        int32_t (*input)(void *runtime);
+        void (*output)(void *runtime, int32_t value);
+        // Runs the Call instruction at pc of the function whose frame is
+        // regs, returns the frame again as the call may have moved it
+        int32_t *(*call)(
+            void *runtime, int32_t *regs, uint32_t pc, uint32_t function);
+    };
+
+    // Machine code of a function, which reads and writes the registers of
+    // its frame in memory like the interpreter. Execution can therefore
+    // move from the interpreter to the machine code at any instruction
+    class JitFunction {
+      public:
+        JitFunction(
+            void *code, size_t size, std::vector<uint32_t> offsets,
+            uint32_t entry);
+        JitFunction(const JitFunction &) = delete;
+        JitFunction &operator=(const JitFunction &) = delete;
+        ~JitFunction();
+
+        // Runs the function from the instruction at pc until it returns
+        int32_t run(int32_t *regs, void *runtime, uint32_t pc) const;
+
+        size_t size() const {
+            return code_size;
+        }
+
+      private:
+        using Code = int32_t (*)(int32_t *, void *, const void *);
+
+        void *code;
+        size_t code_size;
+        // Offset into the machine code of every instruction of the function
+        std::vector<uint32_t> offsets;
+        uint32_t entry;
+    };
+
+    // Compiles the function to machine code, none if machine code is not
+    // supported on this system
+    std::unique_ptr<JitFunction> jit_compile(
+        const Program &program, uint32_t function, const JitHelpers &helpers);
+}
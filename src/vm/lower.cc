@@ -0,0 +1,360 @@
+#include "../internal.hh"
+#include "../utils.hh"
+#include "bytecode.hh"
+
+namespace whilelang {
+    using namespace trieste;
+
+    namespace {
+        class FunctionLowering {
+          public:
+            FunctionLowering(
+                vm::Program &program,
+                const std::map<std::string, uint32_t> &functions)
+                : program(program), functions(functions) {}
+
+            // Appends the code of the function to the program and returns
+            // the size of its frame
+            uint32_t lower(const Node &fun_def) {
+                for (const auto &param : *(fun_def / ParamList)) {
+                    reg(param / Ident);
+                }
+                // Every variable gets its register before any scratch
+                // register is handed out
+                (fun_def / Blocks)->traverse([&](Node node) {
+                    if (node == Ident) {
+                        reg(node);
+                        occurrences[get_identifier(node)]++;
+                    }
+                    return true;
+                });
+
+                auto blocks = fun_def / Blocks;
+                for (size_t i = 0; i < blocks->size(); i++) {
+                    auto block = blocks->at(i);
+                    labels[get_identifier(block / Label)] =
+                        program.code.size();
+
+                    auto body = block / Body;
+                    auto term = block / Jump;
+                    size_t end = body->size();
+                    Node compare = term == Cond
+                        ? fusable_compare(body, term, end)
+                        : Node{};
+
+                    for (size_t j = 0; j < end; j++) {
+                        lower_stmt(body->at(j) / Stmt);
+                    }
+
+                    if (compare) {
+                        lower_compare_branch(compare, term);
+                    } else if (
+                        term != Jump || i + 1 == blocks->size() ||
+                        get_identifier(term / Label) !=
+                            get_identifier(blocks->at(i + 1) / Label)) {
+                        // Jumps to the next block fall through
+                        lower_terminator(term);
+                    }
+                }
+
+                for (const auto &[pos, label] : fixups) {
+                    program.code[pos] = labels.at(label);
+                }
+                return registers.size() + scratch;
+            }
+
+          private:
+            vm::Program &program;
+            const std::map<std::string, uint32_t> &functions;
+
+            std::map<std::string, uint32_t> registers;
+            // Definitions and uses of every variable
+            std::map<std::string, size_t> occurrences;
+            // Number of registers after the variables that hold the
+            // constants and inputs of the operands of an instruction
+            uint32_t scratch = 0;
+
+            std::map<std::string, uint32_t> labels;
+            std::vector<std::pair<size_t, std::string>> fixups;
+
+            uint32_t reg(const Node &ident) {
+                auto name = get_identifier(ident);
+                auto res = registers.find(name);
+                if (res == registers.end()) {
+                    uint32_t next = registers.size();
+                    res = registers.insert({name, next}).first;
+                }
+                return res->second;
+            }
+
+            uint32_t scratch_reg(size_t position) {
+                scratch =
+                    std::max(scratch, static_cast<uint32_t>(position + 1));
+                return registers.size() + position;
+            }
+
+            void emit(vm::Op op, std::initializer_list<uint32_t> operands) {
+                program.code.push_back(static_cast<uint32_t>(op));
+                program.code.insert(
+                    program.code.end(), operands.begin(), operands.end());
+            }
+
+            void emit_label(const Node &label) {
+                fixups.push_back(
+                    {program.code.size(), get_identifier(label)});
+                program.code.push_back(0);
+            }
+
+            // The register holding the value of an Atom or BAtom, constants
+            // and inputs are first loaded into a scratch register
+            uint32_t operand(const Node &atom, size_t position) {
+                Node expr = atom / Expr;
+
+                if (expr == Ident) {
+                    return reg(expr);
+                }
+
+                uint32_t dst = scratch_reg(position);
+                if (expr == Int) {
+                    emit(vm::Op::Const, {dst, as_word(get_int_value(expr))});
+                } else if (expr == True || expr == False) {
+                    emit(vm::Op::Const, {dst, expr == True});
+                } else {
+                    emit(vm::Op::Input, {dst});
+                }
+                return dst;
+            }
+
+            static uint32_t as_word(int value) {
+                return static_cast<uint32_t>(value);
+            }
+
+            static vm::Op binary_op(const Node &expr) {
+                if (expr == Add) {
+                    return vm::Op::Add;
+                } else if (expr == Sub) {
+                    return vm::Op::Sub;
+                } else if (expr == Mul) {
+                    return vm::Op::Mul;
+                } else if (expr == LT) {
+                    return vm::Op::Lt;
+                } else if (expr == Equals) {
+                    return vm::Op::Eq;
+                } else if (expr == And) {
+                    return vm::Op::And;
+                } else if (expr == Or) {
+                    return vm::Op::Or;
+                }
+                throw std::runtime_error(
+                    "Invalid operator: " + std::string(expr->type().str()));
+            }
+
+            void lower_stmt(const Node &stmt) {
+                if (stmt == Skip) {
+                    return;
+                } else if (stmt == Output) {
+                    emit(vm::Op::Output, {operand(stmt / Atom, 0)});
+                    return;
+                }
+
+                Node expr = (stmt / Rhs) / Expr;
+                uint32_t dst = reg(stmt / Ident);
+
+                if (expr == Atom || expr == BAtom) {
+                    Node value = expr / Expr;
+
+                    if (value == Ident) {
+                        emit(vm::Op::Copy, {dst, reg(value)});
+                    } else if (value == Input) {
+                        emit(vm::Op::Input, {dst});
+                    } else if (value == Int) {
+                        emit(
+                            vm::Op::Const,
+                            {dst, as_word(get_int_value(value))});
+                    } else {
+                        emit(vm::Op::Const, {dst, value == True});
+                    }
+                } else if (expr == Not) {
+                    emit(vm::Op::Not, {dst, operand(expr / BAtom, 0)});
+                } else if (expr == FunCall) {
+                    auto fun_id = get_identifier(expr / FunId);
+                    auto callee = functions.find(fun_id);
+                    if (callee == functions.end()) {
+                        throw std::runtime_error(
+                            "Call to undefined function " + fun_id);
+                    }
+
+                    std::vector<uint32_t> args;
+                    for (const auto &arg : *(expr / ArgList)) {
+                        args.push_back(operand(arg / Atom, args.size()));
+                    }
+
+                    emit(
+                        vm::Op::Call,
+                        {dst,
+                         callee->second,
+                         static_cast<uint32_t>(args.size())});
+                    program.code.insert(
+                        program.code.end(), args.begin(), args.end());
+                } else if (auto imm = add_immediate(expr)) {
+                    emit(vm::Op::AddImm, {dst, operand(imm->first, 0),
+                                          imm->second});
+                } else {
+                    uint32_t lhs = operand(expr / Lhs, 0);
+                    uint32_t rhs = operand(expr / Rhs, 1);
+                    emit(binary_op(expr), {dst, lhs, rhs});
+                }
+            }
+
+            // The other operand and the constant added to it when expr is
+            // an Add with a constant operand or a Sub of a constant
+            static std::optional<std::pair<Node, uint32_t>>
+            add_immediate(const Node &expr) {
+                Node lhs = expr / Lhs;
+                Node rhs = expr / Rhs;
+
+                if (expr == Sub && rhs / Expr == Int) {
+                    return std::pair{
+                        lhs, 0u - as_word(get_int_value(rhs / Expr))};
+                } else if (expr != Add) {
+                    return std::nullopt;
+                } else if (rhs / Expr == Int) {
+                    return std::pair{lhs, as_word(get_int_value(rhs / Expr))};
+                } else if (lhs / Expr == Int) {
+                    return std::pair{rhs, as_word(get_int_value(lhs / Expr))};
+                }
+                return std::nullopt;
+            }
+
+            // The assignment x = a < b or x = a = b at the end of the body
+            // when the block branches on x, possibly through a copy y = x as
+            // emitted for the condition of a loop. The copy is only fused
+            // when y is read by the branch alone. end is moved before the
+            // fused statements
+            Node
+            fusable_compare(const Node &body, const Node &cond, size_t &end) {
+                auto assignment = [&](size_t back) -> Node {
+                    if (end < back || body->at(end - back) / Stmt != Assign) {
+                        return {};
+                    }
+                    return body->at(end - back) / Stmt;
+                };
+
+                auto name = get_identifier(cond / Ident);
+                size_t fused = 1;
+                Node compare = assignment(1);
+
+                if (!compare) {
+                    return {};
+                }
+
+                Node copied = (compare / Rhs) / Expr;
+                if (copied == BAtom && copied / Expr == Ident &&
+                    get_identifier(compare / Ident) == name &&
+                    occurrences[name] == 2) {
+                    name = get_identifier(copied / Expr);
+                    fused = 2;
+                    compare = assignment(2);
+                }
+
+                if (!compare || get_identifier(compare / Ident) != name ||
+                    !((compare / Rhs) / Expr)->type().in({LT, Equals})) {
+                    return {};
+                }
+
+                end -= fused;
+                return compare;
+            }
+
+            void lower_compare_branch(const Node &compare, const Node &cond) {
+                Node expr = (compare / Rhs) / Expr;
+                uint32_t lhs = operand(expr / Lhs, 0);
+                uint32_t rhs = operand(expr / Rhs, 1);
+
+                emit(
+                    expr == LT ? vm::Op::LtCond : vm::Op::EqCond,
+                    {reg(compare / Ident), lhs, rhs});
+                emit_label(cond / Then);
+                emit_label(cond / Else);
+            }
+
+            void lower_terminator(const Node &term) {
+                if (term == Jump) {
+                    emit(vm::Op::Jump, {});
+                    emit_label(term / Label);
+                } else if (term == Cond) {
+                    emit(vm::Op::Cond, {reg(term / Ident)});
+                    emit_label(term / Then);
+                    emit_label(term / Else);
+                } else {
+                    emit(vm::Op::Return, {reg(term / Ident)});
+                }
+            }
+        };
+    }
+
+    // Lowers the blocks of every function to bytecode for the interpreter.
+    // Variables become registers of the frame of their function, with the
+    // parameters in the first registers where the caller places the
+    // arguments. Blocks are laid out in order and labels become offsets.
+    //
+    // The most frequent shapes of the normalized code are fused into
+    // superinstructions: a comparison that a block ends by branching on
+    // becomes a single compare and branch, and adding or subtracting a
+    // constant takes the constant as an immediate
+    PassDef lower_bytecode(std::shared_ptr<vm::Program> program) {
+        PassDef lower_bytecode = {
+            "lower_bytecode", blockify_wf, dir::topdown | dir::once, {}};
+
+        lower_bytecode.post([=](Node ast) {
+            *program = vm::Program();
+
+            std::map<std::string, uint32_t> functions;
+            for (const auto &fun_def : *ast->front()) {
+                auto name = get_identifier(fun_def / FunId);
+                uint32_t index = program->functions.size();
+                functions.insert({name, index});
+                program->functions.push_back(
+                    {name,
+                     0,
+                     static_cast<uint32_t>((fun_def / ParamList)->size()),
+                     0});
+            }
+
+            if (!functions.contains("main")) {
+                throw std::runtime_error("Program has no main function");
+            }
+            program->main = functions.at("main");
+
+            for (const auto &fun_def : *ast->front()) {
+                auto &function =
+                    program->functions[functions.at(
+                        get_identifier(fun_def / FunId))];
+                function.entry = program->code.size();
+
+                FunctionLowering lowering(*program, functions);
+                function.registers = lowering.lower(fun_def);
+            }
+
+            size_t registers = 0;
+            for (const auto &function : program->functions) {
+                registers += function.registers;
+            }
+
+            vm::allocate_registers(*program);
+
+            size_t allocated = 0;
+            for (const auto &function : program->functions) {
+                allocated += function.registers;
+            }
+
+            logging::Debug() << "Lowered " << program->functions.size()
+                             << " functions to " << program->code.size()
+                             << " words of bytecode, allocating " << registers
+                             << " registers to " << allocated;
+            return 0;
+        });
+
+        return lower_bytecode;
+    }
+}
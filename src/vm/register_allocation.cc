@@ -0,0 +1,502 @@
+#include "../analyses/dense_state.hh"
+#include "bytecode.hh"
+
+#include <algorithm>
+#include <map>
+#include <numeric>
+#include <set>
+#include <stdexcept>
+
+namespace whilelang::vm {
+    namespace {
+        struct Instruction {
+            uint32_t pc;
+            // Positions in the code of the registers read and written
+            std::vector<uint32_t> uses;
+            std::optional<uint32_t> def;
+        };
+
+        struct BasicBlock {
+            size_t first;
+            size_t last;
+            std::vector<size_t> succs;
+        };
+
+        // The registers of a web get a single location over the interval
+        // from its first to its last position. Position 2i is where
+        // instruction i reads its operands and 2i + 1 where it writes its
+        // result, so a value may take the location of an operand that dies
+        // in the same instruction
+        struct Interval {
+            size_t web;
+            size_t start = SIZE_MAX;
+            size_t end = 0;
+            // Parameters stay in the register the caller passes them in
+            std::optional<uint32_t> fixed;
+            uint32_t location = 0;
+
+            void cover(size_t pos) {
+                start = std::min(start, pos);
+                end = std::max(end, pos);
+            }
+        };
+
+        bool is_terminator(Op op) {
+            return op == Op::Jump || op == Op::Cond || op == Op::Return ||
+                op == Op::LtCond || op == Op::EqCond;
+        }
+
+        Instruction decode(const std::vector<uint32_t> &code, uint32_t pc) {
+            Instruction inst{pc, {}, std::nullopt};
+            auto op = static_cast<Op>(code[pc]);
+
+            switch (op) {
+                case Op::Const:
+                case Op::Input:
+                    inst.def = pc + 1;
+                    break;
+                case Op::Output:
+                case Op::Cond:
+                case Op::Return:
+                    inst.uses = {pc + 1};
+                    break;
+                case Op::Jump:
+                    break;
+                case Op::Call:
+                    inst.def = pc + 1;
+                    for (uint32_t i = 0; i < code[pc + 3]; i++) {
+                        inst.uses.push_back(pc + 4 + i);
+                    }
+                    break;
+                case Op::Copy:
+                case Op::Not:
+                case Op::AddImm:
+                    inst.def = pc + 1;
+                    inst.uses = {pc + 2};
+                    break;
+                default:
+                    inst.def = pc + 1;
+                    inst.uses = {pc + 2, pc + 3};
+                    break;
+            }
+            return inst;
+        }
+
+        // Offsets of the code the instruction may branch to
+        std::vector<uint32_t>
+        branch_targets(const std::vector<uint32_t> &code, uint32_t pc) {
+            switch (static_cast<Op>(code[pc])) {
+                case Op::Jump:
+                    return {code[pc + 1]};
+                case Op::Cond:
+                    return {code[pc + 2], code[pc + 3]};
+                case Op::LtCond:
+                case Op::EqCond:
+                    return {code[pc + 4], code[pc + 5]};
+                default:
+                    return {};
+            }
+        }
+
+        class UnionFind {
+          public:
+            explicit UnionFind(size_t size) : parents(size) {
+                std::iota(parents.begin(), parents.end(), 0);
+            }
+
+            size_t find(size_t i) {
+                while (parents[i] != i) {
+                    parents[i] = parents[parents[i]];
+                    i = parents[i];
+                }
+                return i;
+            }
+
+            void unite(size_t a, size_t b) {
+                parents[find(a)] = find(b);
+            }
+
+          private:
+            std::vector<size_t> parents;
+        };
+
+        class FunctionAllocation {
+          public:
+            FunctionAllocation(Program &program, Function &function)
+                : program(program), function(function) {}
+
+            void run() {
+                decode_function();
+                find_blocks();
+                find_webs();
+                build_intervals();
+                linear_scan();
+
+                for (const auto &[pos, web] : operand_webs) {
+                    program.code[pos] = intervals[web].location;
+                }
+
+                uint32_t frame = function.params;
+                for (const auto &interval : intervals) {
+                    if (interval.start != SIZE_MAX) {
+                        frame = std::max(frame, interval.location + 1);
+                    }
+                }
+                function.registers = frame;
+            }
+
+          private:
+            Program &program;
+            Function &function;
+
+            std::vector<Instruction> insts;
+            std::map<uint32_t, size_t> inst_at;
+            std::vector<BasicBlock> blocks;
+
+            // The web of every register operand, by position in the code
+            std::map<uint32_t, size_t> operand_webs;
+            size_t webs = 0;
+            std::vector<Interval> intervals;
+
+            void decode_function() {
+                uint32_t end = program.code.size();
+                for (const auto &other : program.functions) {
+                    if (other.entry > function.entry && other.entry < end) {
+                        end = other.entry;
+                    }
+                }
+
+                for (uint32_t pc = function.entry; pc < end;
+                     pc += instruction_size(program.code, pc)) {
+                    inst_at[pc] = insts.size();
+                    insts.push_back(decode(program.code, pc));
+                }
+            }
+
+            void find_blocks() {
+                std::set<size_t> leaders = {0};
+                for (size_t i = 0; i < insts.size(); i++) {
+                    auto pc = insts[i].pc;
+                    for (auto target : branch_targets(program.code, pc)) {
+                        leaders.insert(inst_at.at(target));
+                    }
+                    if (is_terminator(static_cast<Op>(program.code[pc])) &&
+                        i + 1 < insts.size()) {
+                        leaders.insert(i + 1);
+                    }
+                }
+
+                std::vector<size_t> block_of(insts.size());
+                for (auto it = leaders.begin(); it != leaders.end(); it++) {
+                    auto next = std::next(it);
+                    size_t last = next == leaders.end() ? insts.size() - 1
+                                                        : *next - 1;
+                    for (size_t i = *it; i <= last; i++) {
+                        block_of[i] = blocks.size();
+                    }
+                    blocks.push_back({*it, last, {}});
+                }
+
+                for (size_t b = 0; b < blocks.size(); b++) {
+                    auto pc = insts[blocks[b].last].pc;
+                    auto op = static_cast<Op>(program.code[pc]);
+
+                    for (auto target : branch_targets(program.code, pc)) {
+                        blocks[b].succs.push_back(
+                            block_of[inst_at.at(target)]);
+                    }
+                    // Jumps to the next block were left out by lowering
+                    if (!is_terminator(op) && b + 1 < blocks.size()) {
+                        blocks[b].succs.push_back(b + 1);
+                    }
+                }
+            }
+
+            // Splits the registers into webs, the definitions reaching a
+            // common use together with their uses. A register reused for
+            // unrelated values becomes several webs that are allocated
+            // independently. Definition v < registers is the value of
+            // register v on entry, the parameters or an unassigned variable
+            void find_webs() {
+                uint32_t registers = function.registers;
+                std::vector<uint32_t> def_reg(registers);
+                std::iota(def_reg.begin(), def_reg.end(), 0);
+                std::map<uint32_t, size_t> def_id;
+
+                for (const auto &inst : insts) {
+                    if (inst.def) {
+                        def_id[*inst.def] = def_reg.size();
+                        def_reg.push_back(program.code[*inst.def]);
+                    }
+                }
+
+                std::vector<std::vector<size_t>> defs_of(registers);
+                for (size_t d = 0; d < def_reg.size(); d++) {
+                    defs_of[def_reg[d]].push_back(d);
+                }
+
+                auto define = [&](BitVector &reaching, uint32_t pos) {
+                    for (auto d : defs_of[program.code[pos]]) {
+                        reaching.erase(d);
+                    }
+                    reaching.insert(def_id.at(pos));
+                };
+
+                // Reaching definitions, forward over the blocks
+                std::vector<BitVector> in(
+                    blocks.size(), BitVector(def_reg.size()));
+                for (uint32_t v = 0; v < registers; v++) {
+                    in[0].insert(v);
+                }
+
+                bool changed = true;
+                while (changed) {
+                    changed = false;
+                    for (size_t b = 0; b < blocks.size(); b++) {
+                        BitVector out = in[b];
+                        for (size_t i = blocks[b].first; i <= blocks[b].last;
+                             i++) {
+                            if (insts[i].def) {
+                                define(out, *insts[i].def);
+                            }
+                        }
+                        for (auto succ : blocks[b].succs) {
+                            changed |= in[succ].join(out);
+                        }
+                    }
+                }
+
+                UnionFind sets(def_reg.size());
+                std::map<uint32_t, size_t> operand_defs;
+
+                for (size_t b = 0; b < blocks.size(); b++) {
+                    BitVector reaching = in[b];
+                    for (size_t i = blocks[b].first; i <= blocks[b].last;
+                         i++) {
+                        for (auto pos : insts[i].uses) {
+                            auto reg = program.code[pos];
+                            // Uses in unreachable code read the entry value
+                            size_t first = reg;
+                            bool found = false;
+                            for (auto d : defs_of[reg]) {
+                                if (!reaching.contains(d)) {
+                                    continue;
+                                }
+                                if (found) {
+                                    sets.unite(d, first);
+                                } else {
+                                    first = d;
+                                    found = true;
+                                }
+                            }
+                            operand_defs[pos] = first;
+                        }
+
+                        if (insts[i].def) {
+                            define(reaching, *insts[i].def);
+                            operand_defs[*insts[i].def] =
+                                def_id.at(*insts[i].def);
+                        }
+                    }
+                }
+
+                std::map<size_t, size_t> web_of_root;
+                auto web_of = [&](size_t def) {
+                    auto root = sets.find(def);
+                    auto res = web_of_root.find(root);
+                    if (res == web_of_root.end()) {
+                        res = web_of_root.insert({root, webs++}).first;
+                    }
+                    return res->second;
+                };
+
+                for (const auto &[pos, def] : operand_defs) {
+                    operand_webs[pos] = web_of(def);
+                }
+
+                intervals.resize(webs);
+                for (size_t w = 0; w < webs; w++) {
+                    intervals[w].web = w;
+                }
+
+                // Webs holding the value of a register on entry start
+                // there, those of the parameters in their own register
+                for (uint32_t v = 0; v < registers; v++) {
+                    auto res = web_of_root.find(sets.find(v));
+                    if (res == web_of_root.end()) {
+                        continue;
+                    }
+                    intervals[res->second].cover(0);
+                    if (v < function.params) {
+                        intervals[res->second].fixed = v;
+                    }
+                }
+            }
+
+            // Liveness of the webs, backward over the blocks like the
+            // liveness analysis of the optimizer, extends the intervals
+            // over the blocks the webs are live through
+            void build_intervals() {
+                std::vector<BitVector> gen(blocks.size(), BitVector(webs));
+                std::vector<BitVector> kill(blocks.size(), BitVector(webs));
+
+                for (size_t b = 0; b < blocks.size(); b++) {
+                    for (size_t i = blocks[b].first; i <= blocks[b].last;
+                         i++) {
+                        for (auto pos : insts[i].uses) {
+                            auto web = operand_webs.at(pos);
+                            if (!kill[b].contains(web)) {
+                                gen[b].insert(web);
+                            }
+                            intervals[web].cover(2 * i);
+                        }
+                        if (insts[i].def) {
+                            auto web = operand_webs.at(*insts[i].def);
+                            kill[b].insert(web);
+                            intervals[web].cover(2 * i + 1);
+                        }
+                    }
+                }
+
+                std::vector<BitVector> live_in(blocks.size(), BitVector(webs));
+                std::vector<BitVector> live_out(
+                    blocks.size(), BitVector(webs));
+
+                bool changed = true;
+                while (changed) {
+                    changed = false;
+                    for (size_t b = blocks.size(); b-- > 0;) {
+                        for (auto succ : blocks[b].succs) {
+                            live_out[b].join(live_in[succ]);
+                        }
+
+                        BitVector in = gen[b];
+                        live_out[b].for_each([&](size_t web) {
+                            if (!kill[b].contains(web)) {
+                                in.insert(web);
+                            }
+                        });
+                        changed |= live_in[b].join(in);
+                    }
+                }
+
+                for (size_t b = 0; b < blocks.size(); b++) {
+                    live_in[b].for_each([&](size_t web) {
+                        intervals[web].cover(2 * blocks[b].first);
+                    });
+                    live_out[b].for_each([&](size_t web) {
+                        intervals[web].cover(2 * blocks[b].last + 1);
+                    });
+                }
+            }
+
+            // Linear scan over the intervals by start. The first
+            // machine_registers locations are registers, an interval that
+            // finds none of them free spills either itself or the active
+            // interval ending last, whichever ends later. The spilled
+            // intervals then share the frame slots after the registers by
+            // a second scan
+            void linear_scan() {
+                std::vector<Interval *> order;
+                for (auto &interval : intervals) {
+                    if (interval.start != SIZE_MAX) {
+                        order.push_back(&interval);
+                    }
+                }
+                // The parameters claim their registers first
+                auto by_start = [](Interval *a, Interval *b) {
+                    return std::pair{a->start, !a->fixed} <
+                        std::pair{b->start, !b->fixed};
+                };
+                std::sort(order.begin(), order.end(), by_start);
+
+                std::vector<Interval *> spilled;
+                scan(
+                    order, 0, machine_registers, [&](Interval *interval) {
+                        spilled.push_back(interval);
+                    });
+
+                std::sort(spilled.begin(), spilled.end(), by_start);
+                scan(
+                    spilled,
+                    machine_registers,
+                    UINT32_MAX,
+                    [](Interval *) {
+                        throw std::runtime_error("Out of frame slots");
+                    });
+            }
+
+            template<typename Spill>
+            void scan(
+                const std::vector<Interval *> &order,
+                uint32_t first,
+                uint32_t limit,
+                Spill spill) {
+                std::set<uint32_t> free;
+                uint32_t next = first;
+                std::vector<Interval *> active;
+
+                auto take = [&](uint32_t location) {
+                    free.erase(location);
+                    next = std::max(next, location + 1);
+                };
+
+                for (auto *interval : order) {
+                    std::erase_if(active, [&](Interval *other) {
+                        if (other->end < interval->start) {
+                            free.insert(other->location);
+                            return true;
+                        }
+                        return false;
+                    });
+
+                    if (interval->fixed) {
+                        if (*interval->fixed < first ||
+                            *interval->fixed >= limit) {
+                            spill(interval);
+                            continue;
+                        }
+                        // Locations below a parameter are free until taken
+                        for (uint32_t l = next; l < *interval->fixed; l++) {
+                            free.insert(l);
+                        }
+                        interval->location = *interval->fixed;
+                        take(interval->location);
+                    } else if (!free.empty()) {
+                        interval->location = *free.begin();
+                        take(interval->location);
+                    } else if (next < limit) {
+                        interval->location = next;
+                        take(interval->location);
+                    } else {
+                        auto victim = std::max_element(
+                            active.begin(),
+                            active.end(),
+                            [](Interval *a, Interval *b) {
+                                return std::pair{!a->fixed, a->end} <
+                                    std::pair{!b->fixed, b->end};
+                            });
+
+                        if (victim == active.end() || (*victim)->fixed ||
+                            (*victim)->end <= interval->end) {
+                            spill(interval);
+                            continue;
+                        }
+
+                        interval->location = (*victim)->location;
+                        spill(*victim);
+                        active.erase(victim);
+                    }
+
+                    active.push_back(interval);
+                }
+            }
+        };
+    }
+
+    void allocate_registers(Program &program) {
+        for (auto &function : program.functions) {
+            FunctionAllocation(program, function).run();
+        }
+    }
+}
@@ -1,5 +1,6 @@
 #include "lang.hh"
 #include "utils.hh"
+#include "vm/bytecode.hh"
 
 #include <CLI/CLI.hpp>
 #include <trieste/trieste.h>
@@ -20,10 +21,10 @@ int main(int argc, char const *argv[]) {
 
     bool run = false;
     bool run_static_analysis = false;
-    bool run_zero_analysis = false;
     bool run_gather_stats = false;
     bool run_mermaid = false;
     bool run_inlining = false;
+    whilelang::OptimizationOptions optimizations;
     app.add_flag("-r,--run", run, "Run the program (prompting inputs).");
     app.add_flag(
         "-s,--static-analysis",
@@ -31,8 +32,13 @@ int main(int argc, char const *argv[]) {
         "Compile and run static analysis on the program.");
     app.add_flag(
         "-z,--zero-analysis",
-        run_zero_analysis,
+        optimizations.zero_analysis,
         "Enable zero analysis in the static analysis. ");
+    app.add_flag(
+        "--interval-analysis",
+        optimizations.interval_analysis,
+        "Enable interval analysis in the static analysis, deciding "
+        "comparisons from the ranges of their operands.");
 
     app.add_flag(
         "-p, --print-stats",
@@ -45,6 +51,80 @@ int main(int argc, char const *argv[]) {
         "Runs the mermaid pass which parses the final AST into mermaid "
         "format ");
     app.add_flag("-i", run_inlining, "Enables the inlining optimization.");
+    app.add_flag(
+        "--sccp",
+        optimizations.sccp,
+        "Use sparse conditional constant propagation over SSA form instead "
+        "of the dense constant folding in the static analysis.");
+    app.add_flag(
+        "--specialize",
+        optimizations.specialization,
+        "Enable specialization of functions on constant call arguments in "
+        "the static analysis, for calls too costly to inline.");
+    app.add_flag(
+        "--licm",
+        optimizations.licm,
+        "Enable loop-invariant code motion in the static analysis.");
+    app.add_flag(
+        "--gvn",
+        optimizations.gvn,
+        "Enable global value numbering in the static analysis.");
+    app.add_flag(
+        "--copy-propagation",
+        optimizations.copy_propagation,
+        "Enable copy propagation in the static analysis.");
+    app.add_flag(
+        "--simplify",
+        optimizations.simplification,
+        "Enable algebraic simplification and strength reduction in the static "
+        "analysis.");
+    app.add_flag(
+        "--tail-recursion",
+        optimizations.tail_recursion,
+        "Turn self tail calls into loops, before inlining and in the static "
+        "analysis.");
+
+    app.add_option(
+        "--inline-threshold",
+        optimizations.inline_threshold,
+        "Largest cost of a call site that is inlined, in normalized "
+        "statements. Call sites in loops may cost more. The static analysis "
+        "specializes costlier calls passing constants instead.");
+
+    size_t inline_budget = 100;
+    app.add_option(
+        "--inline-budget",
+        inline_budget,
+        "Percentage by which inlining may grow the program.");
+
+    std::string backend = "vir";
+    app.add_option(
+           "-b,--backend",
+           backend,
+           "Backend the program is compiled with: vir for the VIR of vbcc, "
+           "c for C source to compile with the system C compiler and link "
+           "against the while_lib runtime library.")
+        ->check(CLI::IsMember({"vir", "c"}));
+
+    bool run_jit = false;
+    app.add_flag(
+        "--jit",
+        run_jit,
+        "With --run, compile hot functions to machine code while the "
+        "program runs.");
+
+    uint64_t jit_threshold = 1000;
+    app.add_option(
+        "--jit-threshold",
+        jit_threshold,
+        "Number of calls and loop iterations after which a function is "
+        "compiled to machine code, 0 and 1 compile every function on its "
+        "first call.");
+
+    app.add_option(
+        "-j,--threads",
+        optimizations.threads,
+        "Number of threads the static analysis solves functions on.");
 
     std::filesystem::path output_path = "";
     app.add_flag(
@@ -71,18 +151,31 @@ int main(int argc, char const *argv[]) {
         auto result = reader.read();
 
         if (run_inlining) {
-            result = result >> whilelang::inlining_rewriter();
+            result = result >>
+                whilelang::inlining_rewriter(
+                    optimizations.inline_threshold,
+                    inline_budget,
+                    optimizations.tail_recursion);
         }
 
         if (run_static_analysis) {
+            trieste::Rewriter optimizer =
+                whilelang::optimization_analysis(optimizations);
+
             do {
-                result = result >>
-                    whilelang::optimization_analysis(run_zero_analysis);
+                result = result >> optimizer;
             } while (result.ok && result.total_changes > 0 &&
                      !program_empty(result.ast));
         }
 
-        trieste::Rewriter compiler = whilelang::compiler();
+        // Running the program lowers it to bytecode for the interpreter
+        // instead of compiling it
+        auto bytecode = std::make_shared<whilelang::vm::Program>();
+        auto c_source = std::make_shared<std::string>();
+        trieste::Rewriter compiler = run
+            ? whilelang::bytecode_compiler(bytecode)
+            : backend == "c" ? whilelang::c_compiler(c_source)
+                             : whilelang::compiler();
         result = result >> compiler;
 
         trieste::logging::Debug() << "AST after compilation: " << std::endl
@@ -97,11 +190,35 @@ int main(int argc, char const *argv[]) {
         }
         whilelang::log_var_map(vars_map);
 
+        if (run) {
+            whilelang::vm::Stats stats;
+            auto value = whilelang::vm::run(
+                *bytecode,
+                std::cin,
+                std::cout,
+                stats,
+                run_jit ? std::optional(jit_threshold) : std::nullopt);
+
+            trieste::logging::Info()
+                << "Program returned " << value << " after executing "
+                << stats.executed << " instructions";
+            if (run_jit) {
+                trieste::logging::Info()
+                    << "Compiled " << stats.compiled_functions
+                    << " functions to " << stats.machine_code_bytes
+                    << " bytes of machine code";
+            }
+            return 0;
+        }
+
         if (output_path.empty())
-            output_path = input_path.stem().replace_extension(".trieste");
+            output_path = input_path.stem().replace_extension(
+                backend == "c" ? ".c" : ".trieste");
 
         std::ofstream f(output_path, std::ios::binary | std::ios::out);
-        if (f) {
+        if (f && backend == "c") {
+            f << *c_source;
+        } else if (f) {
             // Write the AST to the output file.
             f << "vbcc" << std::endl << "VIR" << std::endl << result.ast;
         } else {